@@ -4,94 +4,12 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <numeric>
+#include <algorithm>
 
 IMPLEMENT_APP(EvaluatorApp)
 
-EvaluatorFrame* g_mainFrame;
-Calculator* calc;
-const wxFont EvaluatorFrame::inputControlFont = wxFontInfo(6).FaceName("Helvetica");
-
-void Reposition(wxSizer* sizer) {
-    sizer->RepositionChildren(sizer->CalcMin());
-}
-
-void Refresh() {
-    Reposition(g_mainFrame->mainHbox);
-    g_mainFrame->panel->Refresh();
-}
-
-int GetInputIndex(wxCommandEvent& event) {
-    wxSizerItemList inputs = g_mainFrame->inputSizer->GetChildren();
-    u_int i = 0;
-    for (i = 0; i < inputs.size(); ++i) {
-        if (inputs[i]->GetId() == ((InputEventUserData*)event.GetEventUserData())->getId()) {
-            break;
-        }
-    }
-    return i;
-}
-
-void AddInput(bool insert, bool removeOption, int insertIndex = 0) {
-    wxPanel* window = g_mainFrame->inputWindow;
-    wxBoxSizer* sizer = g_mainFrame->inputSizer;
-    static int inputID = -1;
-    inputID++;
-    wxBoxSizer* container = new wxBoxSizer(wxVERTICAL);
-    wxTextCtrl* value = new wxTextCtrl(window, wxID_ANY, "");
-    value->Bind(wxEVT_TEXT, &OnInputEdited, wxID_ANY, wxID_ANY, new InputEventUserData(inputID));
-    container->Add(value, wxSizerFlags().Expand());
-    wxBoxSizer* controls = new wxBoxSizer(wxHORIZONTAL);
-    wxButton* add = new wxButton(window, wxID_ANY, "+", wxDefaultPosition, wxDefaultSize, wxBU_EXACTFIT);
-    add->SetFont(EvaluatorFrame::inputControlFont);
-    add->Bind(wxEVT_BUTTON, &OnAddInputPressed, wxID_ANY, wxID_ANY, new InputEventUserData(inputID));
-    controls->Add(add);
-    wxButton* eval = new wxButton(window, wxID_ANY, L"\U0001F441", wxDefaultPosition, wxDefaultSize, wxBU_EXACTFIT);
-    eval->SetFont(EvaluatorFrame::inputControlFont);
-    controls->Add(eval);
-    if (removeOption) {
-        wxButton* remove = new wxButton(window, wxID_ANY, "X", wxDefaultPosition, wxDefaultSize, wxBU_EXACTFIT);
-        remove->SetFont(EvaluatorFrame::inputControlFont);
-        remove->Bind(wxEVT_BUTTON, &OnRemoveInputPressed, wxID_ANY, wxID_ANY, new InputEventUserData(inputID));
-        controls->Add(remove);
-    }
-    container->Add(controls, wxSizerFlags().Right());
-    container->AddSpacer(10);
-    if (insert) {
-        sizer->Insert(insertIndex, container, wxSizerFlags().Expand())->SetId(inputID);
-    } else {
-        sizer->Add(container, wxSizerFlags().Expand())->SetId(inputID);
-    }
-    wxLogDebug("%d", insertIndex);
-    calc->AddLine(insertIndex);
-}
-
-void OnAddInputPressed(wxCommandEvent& event) {
-    int index = GetInputIndex(event);
-    AddInput(true, true, index + 1);
-    Refresh();
-}
-
-void OnRemoveInputPressed(wxCommandEvent& event) {
-    int index = GetInputIndex(event);
-    g_mainFrame->inputSizer->Hide(index);
-    bool remove = g_mainFrame->inputSizer->Remove(index);
-    calc->RemoveLine(index);
-    Reposition(g_mainFrame->inputSizer);
-    Refresh();
-}
-
-void OnInputEdited(wxCommandEvent& event) {
-    int index = GetInputIndex(event);
-    wxSizer* sizer = g_mainFrame->inputSizer->GetChildren()[index]->GetSizer();
-    wxTextCtrl* input = wxStaticCast(sizer->GetChildren()[0]->GetWindow(), wxTextCtrl);
-    try {
-        calc->ParseLine(input->GetValue(), index);
-        g_mainFrame->output->SetValue(calc->GetFormattedLine(index));
-    } catch (std::runtime_error e) {
-        g_mainFrame->output->SetValue(e.what());
-    }
-}
-
 bool EvaluatorApp::OnInit() {
     EvaluatorFrame* frame = new EvaluatorFrame("Evaluator");
     frame->Show(true);
@@ -103,20 +21,25 @@ int EvaluatorApp::OnExit() {
 }
 
 EvaluatorFrame::EvaluatorFrame(const wxString& title)
-    : wxFrame(NULL, wxID_ANY, title, wxPoint(-1, -1), wxSize(500, 500)), inputWindow{ NULL }, inputSizer{ NULL } {
-    g_mainFrame = this;
-    calc = &g_mainFrame->calculator;
+    : wxFrame(NULL, wxID_ANY, title, wxPoint(-1, -1), wxSize(500, 500)), inputs{ NULL } {
+    shownGeneration = 0;
+    shownHandle = -1;
+    // the callback runs on the worker thread, queueing an event is the only thing it can do with the frame
+    evaluator = std::make_unique<AsyncEvaluator>(calculator, [this](AsyncResult result) {
+        wxThreadEvent* event = new wxThreadEvent();
+        event->SetPayload(result);
+        wxQueueEvent(this, event);
+    });
+    Bind(wxEVT_THREAD, &EvaluatorFrame::OnEvaluated, this);
+    Bind(wxEVT_CLOSE_WINDOW, &EvaluatorFrame::OnClose, this);
     panel = new wxPanel(this);
     mainHbox = new wxBoxSizer(wxHORIZONTAL);
     wxBoxSizer* left = new wxBoxSizer(wxVERTICAL);
     wxStaticText* labelI = new wxStaticText(panel, wxID_ANY, "Input", wxDefaultPosition, wxDefaultSize, wxALIGN_CENTRE_HORIZONTAL);
     left->Add(labelI, wxSizerFlags().Expand());
-    inputWindow = new wxScrolledWindow(panel);
-    inputSizer = new wxBoxSizer(wxVERTICAL);
-    inputWindow->SetSizer(inputSizer);
-    inputWindow->SetScrollRate(0, 10);
-    AddInput(false, false);
-    left->Add(inputWindow, wxSizerFlags().Proportion(1).Expand());
+    inputs = new InputList(panel, *evaluator);
+    inputs->InsertLine(0);
+    left->Add(inputs, wxSizerFlags().Proportion(1).Expand());
     mainHbox->Add(left, wxSizerFlags().Proportion(1).Expand());
         
     wxBoxSizer* right = new wxBoxSizer(wxVERTICAL);
@@ -125,6 +48,18 @@ EvaluatorFrame::EvaluatorFrame(const wxString& title)
     output = new wxTextCtrl(panel, wxID_ANY, "123982", wxDefaultPosition, wxDefaultSize, wxTE_READONLY);
     output->Bind(wxEVT_LEFT_DOWN, &EvaluatorFrame::OnOutputClicked, this);
     right->Add(output, wxSizerFlags().Expand());
+    wxBoxSizer* profileControls = new wxBoxSizer(wxHORIZONTAL);
+    profile = new wxCheckBox(panel, wxID_ANY, "Profile");
+    profile->Bind(wxEVT_CHECKBOX, &EvaluatorFrame::OnProfileToggled, this);
+    profileControls->Add(profile, wxSizerFlags().Center());
+    wxString sortKeys[] = { "Total time", "Parse time", "Evaluation time", "Expansion time", "Re-parses", "Cache hits" };
+    profileSort = new wxChoice(panel, wxID_ANY, wxDefaultPosition, wxDefaultSize, WXSIZEOF(sortKeys), sortKeys);
+    profileSort->SetSelection(0);
+    profileSort->Bind(wxEVT_CHOICE, &EvaluatorFrame::OnProfileSortChanged, this);
+    profileControls->Add(profileSort, wxSizerFlags().Proportion(1));
+    right->Add(profileControls, wxSizerFlags().Expand());
+    profileReport = new wxTextCtrl(panel, wxID_ANY, "", wxDefaultPosition, wxDefaultSize, wxTE_READONLY | wxTE_MULTILINE | wxTE_DONTWRAP);
+    right->Add(profileReport, wxSizerFlags().Proportion(1).Expand());
     mainHbox->Add(right, wxSizerFlags().Proportion(1).Expand());
 
     panel->SetSizer(mainHbox);
@@ -133,10 +68,101 @@ EvaluatorFrame::EvaluatorFrame(const wxString& title)
     SetStatusText("Evaluator");
 }
 
+// the worker queues events onto the frame, so it has to be stopped while the frame is still whole. The input rows
+// hold on to the evaluator, and wxWindow's destructor would only get to them after the members are gone, so they go
+// here first
+EvaluatorFrame::~EvaluatorFrame() {
+    evaluator->Stop();
+    DestroyChildren();
+}
+
+void EvaluatorFrame::OnClose(wxCloseEvent& event) {
+    // nothing evaluated from here on would be shown. The evaluator itself stays until the destructor has destroyed
+    // the inputs that hold on to it
+    evaluator->Stop();
+    event.Skip();
+}
+
 void EvaluatorFrame::OnOutputClicked(wxMouseEvent& event) {
     wxTextCtrl* text = wxStaticCast(event.GetEventObject(), wxTextCtrl);
     if (wxTheClipboard->Open()) {
         wxTheClipboard->SetData(new wxTextDataObject(text->GetValue()));
         wxTheClipboard->Close();
     }
+}
+
+void EvaluatorFrame::OnProfileToggled(wxCommandEvent& event) {
+    bool enabled = profile->GetValue();
+    evaluator->Post([enabled](Calculator& calculator) { calculator.SetProfiling(enabled); });
+    // the report fills in again with the next evaluation
+    profiles.clear();
+    UpdateProfileReport();
+}
+
+void EvaluatorFrame::OnEvaluated(wxThreadEvent& event) {
+    AsyncResult result = event.GetPayload<AsyncResult>();
+    // the worker only finishes the newest edit, but an older result can still be queued behind a newer one
+    if (result.generation < shownGeneration) {
+        return;
+    }
+    // a line that only reads an edited one is shown when it's the one output shows already
+    if (!result.edited) {
+        if (result.handle == shownHandle) {
+            shownGeneration = result.generation;
+            output->SetValue(result.text);
+        }
+        return;
+    }
+    shownGeneration = result.generation;
+    shownHandle = result.handle;
+    output->SetValue(result.text);
+    profiles = std::move(result.profiles);
+    UpdateProfileReport();
+}
+
+void EvaluatorFrame::OnProfileSortChanged(wxCommandEvent& event) {
+    UpdateProfileReport();
+}
+
+static double Milliseconds(uint64_t nanoseconds) {
+    return nanoseconds / 1e6;
+}
+
+// the slowest lines by whatever profileSort has selected, biggest first
+void EvaluatorFrame::UpdateProfileReport() {
+    if (!profile->GetValue()) {
+        profileReport->Clear();
+        SetStatusText("Evaluator");
+        return;
+    }
+    static const size_t shown = 20;
+    int key = profileSort->GetSelection();
+    auto sortValue = [key](const LineProfile& p) -> uint64_t {
+        switch (key) {
+        case 1: return p.parseTime;
+        case 2: return p.evaluateTime;
+        case 3: return p.expandTime;
+        case 4: return p.reparses;
+        case 5: return p.cacheHits;
+        default: return p.parseTime + p.expandTime + p.evaluateTime;
+        }
+    };
+    std::vector<int> order(profiles.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return sortValue(profiles[a]) > sortValue(profiles[b]);
+    });
+    wxString report{};
+    for (size_t i{ 0 }; i < order.size() && i < shown; i++) {
+        const LineProfile& p = profiles[order[i]];
+        report += wxString::Format("line %d: parse %.3f ms (%llu, %llu re-parsed), eval %.3f ms (%llu), expand %.3f ms (%llu tokens), cache %llu/%llu\n",
+            order[i] + 1, Milliseconds(p.parseTime), (unsigned long long) p.parses, (unsigned long long) p.reparses,
+            Milliseconds(p.evaluateTime), (unsigned long long) p.evaluations, Milliseconds(p.expandTime), (unsigned long long) p.expandedTokens,
+            (unsigned long long) p.cacheHits, (unsigned long long) (p.cacheHits + p.cacheMisses));
+    }
+    profileReport->SetValue(report);
+    if (!order.empty()) {
+        const LineProfile& slowest = profiles[order[0]];
+        SetStatusText(wxString::Format("Slowest: line %d, %.3f ms", order[0] + 1, Milliseconds(slowest.parseTime + slowest.expandTime + slowest.evaluateTime)));
+    }
 }
\ No newline at end of file
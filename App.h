@@ -5,11 +5,12 @@
 #   include "wx/wx.h"
 #endif
 
-#include "Calculator.h"
+#include <memory>
+#include <vector>
 
-void OnAddInputPressed(wxCommandEvent& event);
-void OnRemoveInputPressed(wxCommandEvent& event);
-void OnInputEdited(wxCommandEvent& event);
+#include "Calculator.h"
+#include "AsyncEvaluator.h"
+#include "InputList.h"
 
 class EvaluatorApp : public wxApp {
 public:
@@ -19,33 +20,31 @@ public:
 
 class EvaluatorFrame : public wxFrame {
 public:
-    static const wxFont inputControlFont;
     Calculator calculator;
-    wxScrolledWindow* inputWindow;
-    wxBoxSizer* inputSizer;
+    // every call into calculator goes through here, declared after it so it goes first. Stopped, and the inputs that
+    // reference it destroyed, in the frame's destructor
+    std::unique_ptr<AsyncEvaluator> evaluator;
+    uint64_t shownGeneration; // of the edit output currently shows
+    int shownHandle; // of the line output currently shows
+    std::vector<LineProfile> profiles; // from the latest evaluation, while profiling
+    InputList* inputs;
     wxPanel* panel;
     wxBoxSizer* mainHbox;
     wxTextCtrl* output;
+    wxCheckBox* profile;
+    wxChoice* profileSort;
+    wxTextCtrl* profileReport;
 
     EvaluatorFrame(const wxString& title);
+    ~EvaluatorFrame();
+    void UpdateProfileReport();
 
 private:
     void OnOutputClicked(wxMouseEvent& event);
-};
-
-class InputEventUserData : public wxObject {
-private:
-    int id;
-
-public:
-    InputEventUserData(int id) : id{ id } {
-    }
-
-    int getId() {
-        return id;
-    }
-
-    virtual ~InputEventUserData() {};
+    void OnProfileToggled(wxCommandEvent& event);
+    void OnProfileSortChanged(wxCommandEvent& event);
+    void OnEvaluated(wxThreadEvent& event);
+    void OnClose(wxCloseEvent& event);
 };
 
 DECLARE_APP(EvaluatorApp);
\ No newline at end of file
@@ -0,0 +1,28 @@
+#include "Arena.h"
+
+Arena::Arena(size_t chunkSize) : chunkSize{ chunkSize } {
+}
+
+void* Arena::Allocate(size_t size, size_t alignment) {
+    while (current < chunks.size()) {
+        size_t aligned = (offset + alignment - 1) / alignment * alignment;
+        if (aligned + size <= chunks[current].size) {
+            offset = aligned + size;
+            return chunks[current].memory.get() + aligned;
+        }
+        // chunks left over from before a Reset get reused in order
+        current++;
+        offset = 0;
+    }
+    // new memory from operator new[] is aligned for any fundamental type
+    size_t allocation = size > chunkSize ? size : chunkSize;
+    chunks.push_back(Chunk{ std::unique_ptr<char[]>(new char[allocation]), allocation });
+    current = chunks.size() - 1;
+    offset = size;
+    return chunks[current].memory.get();
+}
+
+void Arena::Reset() {
+    current = 0;
+    offset = 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// bump allocator over a list of chunks. Nothing is freed individually, Reset makes all of the
+// memory available again (keeping the chunks) and the destructor gives it back in bulk
+class Arena {
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> memory;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t current{ 0 }; // chunk being allocated from
+    size_t offset{ 0 }; // first free byte in it
+    size_t chunkSize;
+
+public:
+    explicit Arena(size_t chunkSize = 16 * 1024);
+    void* Allocate(size_t size, size_t alignment);
+    void Reset();
+};
+
+// lets standard containers allocate from an arena, deallocation is left to the arena
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    Arena* arena;
+
+    ArenaAllocator(Arena& arena) : arena{ &arena } {
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena{ other.arena } {
+    }
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, size_t) {
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena == other.arena;
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+        return arena != other.arena;
+    }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
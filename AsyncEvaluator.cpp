@@ -0,0 +1,189 @@
+#include "AsyncEvaluator.h"
+
+#include <algorithm>
+
+AsyncEvaluator::AsyncEvaluator(Calculator& calculator, std::function<void(AsyncResult)> done, std::chrono::milliseconds debounce)
+    : calculator{ calculator }, done{ std::move(done) }, debounce{ debounce } {
+    calculator.SetCancelFlag(&cancel);
+    thread = std::thread(&AsyncEvaluator::Run, this);
+}
+
+AsyncEvaluator::~AsyncEvaluator() {
+    Stop();
+    calculator.SetCancelFlag(nullptr);
+}
+
+void AsyncEvaluator::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cancel = true;
+    wake.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void AsyncEvaluator::Push(Job job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    // whatever is being evaluated is out of date now
+    cancel = true;
+    wake.notify_one();
+}
+
+void AsyncEvaluator::AddLine(int index) {
+    Push(Job{ [this, index](Calculator& calculator) {
+        calculator.AddLine(index);
+        // everything from index down moves along by one
+        std::map<int, Pending> shifted{};
+        for (auto& [line, edit] : pending) {
+            shifted.emplace(line >= index ? line + 1 : line, edit);
+        }
+        pending = std::move(shifted);
+    }, -1, "", 0 });
+}
+
+void AsyncEvaluator::RemoveLine(int index) {
+    Push(Job{ [this, index](Calculator& calculator) {
+        Changed(index);
+        calculator.RemoveLine(index);
+        std::map<int, Pending> shifted{};
+        for (auto& [line, edit] : pending) {
+            if (line != index) {
+                shifted.emplace(line > index ? line - 1 : line, edit);
+            }
+        }
+        pending = std::move(shifted);
+    }, -1, "", 0 });
+}
+
+uint64_t AsyncEvaluator::Edit(int index, std::string source) {
+    uint64_t edit;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        edit = ++generation;
+        jobs.push_back(Job{ nullptr, index, std::move(source), edit });
+    }
+    cancel = true;
+    wake.notify_one();
+    return edit;
+}
+
+void AsyncEvaluator::Post(std::function<void(Calculator&)> job) {
+    Push(Job{ std::move(job), -1, "", 0 });
+}
+
+void AsyncEvaluator::Apply(Job& job) {
+    if (job.apply != nullptr) {
+        try {
+            job.apply(calculator);
+        } catch (std::exception&) {
+        }
+        return;
+    }
+    // every edit gets parsed, a later one might be for a different line
+    // only the part that differs from the last parse, a character or two while typing, gets tokenized again
+    const std::string& before = calculator.GetLine(job.index).source;
+    const std::string& after = job.source;
+    size_t prefix{ 0 };
+    while (prefix < before.size() && prefix < after.size() && before[prefix] == after[prefix]) {
+        prefix++;
+    }
+    size_t suffix{ 0 };
+    while (suffix < before.size() - prefix && suffix < after.size() - prefix && before[before.size() - 1 - suffix] == after[after.size() - 1 - suffix]) {
+        suffix++;
+    }
+    Changed(job.index);
+    pending[job.index] = Pending{ job.generation, calculator.TryEditLine(job.index, prefix, before.size() - prefix - suffix, std::string_view(after).substr(prefix, after.size() - prefix - suffix)) };
+    // what the line defines after the edit might have been undefined until now
+    Changed(job.index);
+    applied = job.generation;
+}
+
+// the lines reading what index defines need showing again
+void AsyncEvaluator::Changed(int index) {
+    const InputLine& line = calculator.GetLine(index);
+    if (line.type != InputLineType::Expression) {
+        changed.insert(line.symbol);
+    }
+}
+
+void AsyncEvaluator::Evaluate() {
+    // oldest edit first, so the newest result is the one handed over last
+    std::vector<std::pair<int, Pending>> lines(pending.begin(), pending.end());
+    std::sort(lines.begin(), lines.end(), [](const auto& a, const auto& b) { return a.second.generation < b.second.generation; });
+    std::set<int> evaluated{};
+    for (const auto& [index, line] : lines) {
+        if (!Evaluate(index, line, true)) {
+            // the rest stay pending, they get another go once the newer jobs are in
+            return;
+        }
+        pending.erase(index);
+        evaluated.insert(index);
+    }
+    // then whatever reads the edited lines, which may well have changed with them
+    for (int index : calculator.GetDependentLines(std::vector<int>(changed.begin(), changed.end()))) {
+        if (evaluated.count(index) == 0 && !Evaluate(index, Pending{ applied, CalcStatus{ ECNone, -1, SymbolTable::None } }, false)) {
+            return;
+        }
+    }
+    changed.clear();
+}
+
+// false when it was cancelled
+bool AsyncEvaluator::Evaluate(int index, const Pending& line, bool edited) {
+    AsyncResult result{ line.generation, index, calculator.GetLineHandle(index), edited, "", {} };
+    CalcStatus status = line.error;
+    if (status.Ok()) {
+        status = calculator.TryGetFormattedLine(index, result.text);
+    }
+    if (status.code == ECCancelled) {
+        return false;
+    }
+    if (!status.Ok()) {
+        result.text = calculator.GetErrorMessage(status);
+    }
+    if (edited && calculator.IsProfiling()) {
+        // only for the profile, an expression's expansion isn't used otherwise
+        std::deque<PostfixItem> expanded{};
+        if (calculator.TryGetExpandedPostfix(index, expanded).code == ECCancelled) {
+            return false;
+        }
+        for (int i{ 0 }; i < calculator.LineCount(); i++) {
+            result.profiles.push_back(calculator.GetLineProfile(i));
+        }
+    }
+    done(std::move(result));
+    return true;
+}
+
+void AsyncEvaluator::Run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        if (!jobs.empty()) {
+            Job job = std::move(jobs.front());
+            jobs.pop_front();
+            lock.unlock();
+            Apply(job);
+            lock.lock();
+            continue;
+        }
+        if (pending.empty() && changed.empty()) {
+            wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+            continue;
+        }
+        // hold off while edits keep coming in
+        if (wake.wait_for(lock, debounce, [this] { return stopping || !jobs.empty(); })) {
+            continue;
+        }
+        // nothing is queued, so anything that sets the flag from here on really is newer
+        cancel = false;
+        lock.unlock();
+        Evaluate();
+        lock.lock();
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Calculator.h"
+
+// what a line evaluated to, handed to the callback on the worker thread
+struct AsyncResult {
+    uint64_t generation; // of the edit it's for, for a line that wasn't edited the newest one it reflects
+    int index;
+    int handle; // the line's handle, which unlike index still finds it after lines were added or removed
+    bool edited; // false for a line that only reads an edited one
+    std::string text; // the formatted line, or the error
+    std::vector<LineProfile> profiles; // every line's, only while profiling and only for edited lines
+};
+
+// owns every call into a calculator and makes them on a thread of its own, so whoever posts edits never waits
+// on an evaluation. Edits are parsed in order, and once nothing newer has come in for the debounce time every line
+// edited since the last evaluation gets evaluated, the newest edit last, followed by every line that reads what an
+// edited or removed line defines. Anything posted while an evaluation runs cancels it
+class AsyncEvaluator {
+private:
+    struct Job {
+        std::function<void(Calculator&)> apply;
+        int index; // line being edited, or -1
+        std::string source;
+        uint64_t generation;
+    };
+
+    Calculator& calculator;
+    std::function<void(AsyncResult)> done;
+    std::chrono::milliseconds debounce;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Job> jobs;
+    std::atomic<bool> cancel{ false };
+    uint64_t generation{ 0 };
+    bool stopping{ false };
+    struct Pending {
+        uint64_t generation; // of the line's newest edit
+        CalcStatus error; // from parsing the edit, reported instead of evaluating when it failed
+    };
+
+    std::map<int, Pending> pending; // edited lines waiting to be evaluated by index, worker thread only
+    std::set<int> changed; // symbols defined by lines edited or removed since the dependents were last evaluated, worker thread only
+    uint64_t applied{ 0 }; // generation of the newest edit parsed, worker thread only
+    std::thread thread;
+
+    void Push(Job job);
+    void Apply(Job& job);
+    void Changed(int index);
+    void Evaluate();
+    bool Evaluate(int index, const Pending& line, bool edited);
+    void Run();
+
+public:
+    AsyncEvaluator(Calculator& calculator, std::function<void(AsyncResult)> done, std::chrono::milliseconds debounce = std::chrono::milliseconds(30));
+    ~AsyncEvaluator();
+    // cancels whatever runs and waits for the worker, done is never called after this returns. Anything posted
+    // afterwards is dropped
+    void Stop();
+    void AddLine(int index);
+    void RemoveLine(int index);
+    // returns the generation the edit's result will carry, newer edits always get bigger ones
+    uint64_t Edit(int index, std::string source);
+    // runs job on the worker after everything posted before it, for settings and anything else that touches the calculator
+    void Post(std::function<void(Calculator&)> job);
+};
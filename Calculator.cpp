@@ -1,27 +1,72 @@
 #include <cctype>
+#include <cwctype>
 #include <stdexcept>
 #include <functional>
 #include <cmath>
 #include <limits>
+#include <algorithm>
+#include <iterator>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <new>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <utility>
+#include <fstream>
+#include <type_traits>
+#include <charconv>
+#include <system_error>
+#include <unordered_set>
 
 #include "Calculator.h"
+#include "Solver.h"
+
+const int Calculator::Last;
 
 static const double NaN = std::numeric_limits<double>::quiet_NaN();
+static const double Infinity = std::numeric_limits<double>::infinity();
+static const int IntegralPieces = 16; // a range that needs refining is split into this many, each refined on its own
+static const size_t IntegralIntervals = 200; // most a piece gets split into before its estimate is taken as it is
 
-template <typename V_T>
-static std::vector<std::string> getMapKeys(std::map<std::string, V_T> map) {
-    std::vector<std::string> v;
-    for (std::pair<std::string, V_T> p : map) {
-        v.push_back(p.first);
-    }
-    return v;
+static const CalcStatus Success{ ECNone, -1, SymbolTable::None };
+
+static CalcStatus Failure(ErrorCode code, int position = -1, int symbol = SymbolTable::None) {
+    return CalcStatus{ code, position, symbol };
+}
+
+static uint64_t ProfileClock() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-static const std::map<std::string, double> operands = {
-    {"pi", 3.14159265358979323846}
+// adds the time until it goes out of scope to total, throwing included. Doesn't read the clock without a total
+struct ProfileTimer {
+    std::atomic<uint64_t>* total;
+    uint64_t start;
+
+    ProfileTimer(std::atomic<uint64_t>* total) : total{ total }, start{ total != nullptr ? ProfileClock() : 0 } {
+    }
+
+    ~ProfileTimer() {
+        if (total != nullptr) {
+            total->fetch_add(ProfileClock() - start, std::memory_order_relaxed);
+        }
+    }
+};
+
+struct CalcOperand {
+    const char* name;
+    double value;
 };
 
-static const std::vector<std::string> operandKeys = getMapKeys(operands);
+static constexpr CalcOperand operands[] = {
+    { "pi", 3.14159265358979323846 }
+};
+
+static constexpr int OperandCount = sizeof(operands) / sizeof(operands[0]);
 
 enum OpType {
     Operator,
@@ -29,71 +74,326 @@ enum OpType {
     OFunction,
     ParenthesesL,
     ParenthesesR,
+    Separator,
     OOther
 };
 
-typedef std::vector<double> args;
+// every built-in operator and function. A calculator interns them first and in this order, so an operator's
+// symbol is also its Builtin. Adding one takes an entry here, a row in operators and a case in Apply
+enum Builtin {
+    BPercent,
+    BDegrees,
+    BSqrt,
+    BSin,
+    BCos,
+    BTan,
+    BLog,
+    BExp,
+    BMin,
+    BMax,
+    BSolve,
+    BMinimize,
+    BSum,
+    BIntegrate,
+    BAdd,
+    BSubtract,
+    BMultiply,
+    BDivide,
+    BPower,
+    BuiltinCount
+};
 
 struct CalcOperator {
-    std::function<double(args)> function;
+    const char* name;
     int precedence;
     int argumentCount;
     OpType type;
 };
 
-static std::pair<std::string, CalcOperator> basicPostfix(std::string name, std::function<double(args)> function) {
-    return { name, CalcOperator{function, 1, 1, OpType::Postfix} };
+static constexpr CalcOperator operators[BuiltinCount] = {
+    { "%", 1, 1, OpType::Postfix },
+    { "deg", 1, 1, OpType::Postfix },
+    { "sqrt", 0, 1, OpType::OFunction },
+    { "sin", 0, 1, OpType::OFunction },
+    { "cos", 0, 1, OpType::OFunction },
+    { "tan", 0, 1, OpType::OFunction },
+    { "log", 0, 1, OpType::OFunction },
+    { "exp", 0, 1, OpType::OFunction },
+    { "min", 0, 2, OpType::OFunction },
+    { "max", 0, 2, OpType::OFunction },
+    // the function name counts as an argument, but it's compiled into the instruction rather than pushed
+    { "solve", 0, 3, OpType::OFunction },
+    { "minimize", 0, 2, OpType::OFunction },
+    // so do the start of the body and the variable, the body gets compiled into a program of its own
+    { "sum", 0, 5, OpType::OFunction },
+    { "integrate", 0, 5, OpType::OFunction },
+    { "+", -4, 2, OpType::Operator },
+    { "-", -4, 2, OpType::Operator },
+    { "*", -3, 2, OpType::Operator },
+    { "/", -3, 2, OpType::Operator },
+    { "^", -2, 2, OpType::Operator },
+};
+
+// what every built-in does, d points at the operator's arguments on the value stack. Wherever op is known at compile
+// time the switch folds away. T is double, except when the solver runs a body on dual numbers or EvaluateLineAs on
+// another type. solve and minimize need the calculator, so they never get here, and neither do sum and integrate
+template<class T>
+static inline T Apply(int op, const T* d) {
+    using std::sqrt;
+    using std::sin;
+    using std::cos;
+    using std::tan;
+    using std::log;
+    using std::exp;
+    using std::fmin;
+    using std::fmax;
+    using std::pow;
+    switch (op) {
+    case BPercent: return d[0] / 100;
+    case BDegrees: return d[0] * 0.0174533;
+    case BSqrt: return sqrt(d[0]);
+    case BSin: return sin(d[0]);
+    case BCos: return cos(d[0]);
+    case BTan: return tan(d[0]);
+    case BLog: return log(d[0]);
+    case BExp: return exp(d[0]);
+    case BMin: return fmin(d[0], d[1]);
+    case BMax: return fmax(d[0], d[1]);
+    case BAdd: return d[0] + d[1];
+    case BSubtract: return d[0] - d[1];
+    case BMultiply: return d[0] * d[1];
+    case BDivide: return d[0] / d[1];
+    case BPower: return pow(d[0], d[1]);
+    }
+    return NaN;
 }
 
-static std::pair<std::string, CalcOperator> basicFunction(std::string name, std::function<double(args)> function) {
-    return { name, CalcOperator{function, 0, 1, OpType::OFunction} };
+// batch kernels work on whole blocks of lanes in place, the result goes in the first argument's block.
+// they're kept as plain loops over contiguous arrays so the compiler can vectorize them
+typedef void (*BatchKernel)(double* const* arguments, size_t count);
+
+template<int op>
+static void BatchKernelOf(double* const* a, size_t count) {
+    double* x = a[0];
+    if constexpr (operators[op].argumentCount == 1) {
+        for (size_t i{ 0 }; i < count; ++i) {
+            x[i] = Apply(op, x + i);
+        }
+    } else {
+        const double* y = a[1];
+        for (size_t i{ 0 }; i < count; ++i) {
+            double d[2] = { x[i], y[i] };
+            x[i] = Apply(op, d);
+        }
+    }
 }
 
-static std::pair<std::string, CalcOperator> basicOperator(std::string name, int precedence, std::function<double(args)> function) {
-    return { name, CalcOperator{function, precedence, 2, OpType::Operator} };
+template<size_t... I>
+static constexpr std::array<BatchKernel, BuiltinCount> BatchKernels(std::index_sequence<I...>) {
+    return { { BatchKernelOf<I>... } };
 }
 
-static const std::map<std::string, CalcOperator> operators = {
-    basicPostfix("%", [](auto d) { return d[0] / 100; }),
-    basicPostfix("deg", [](auto d) { return d[0] * 0.0174533; }),
-    basicFunction("sqrt", [](auto d) { return std::sqrt(d[0]); }),
-    basicFunction("sin", [](auto d) { return std::sin(d[0]); }),
-    basicOperator("+", -4, [](auto d) { return d[0] + d[1]; }),
-    basicOperator("-", -4, [](auto d) { return d[0] - d[1]; }),
-    basicOperator("*", -3, [](auto d) { return d[0] * d[1]; }),
-    basicOperator("/", -3, [](auto d) { return d[0] / d[1]; }),
-    basicOperator("^", -2, [](auto d) { return std::pow(d[0], d[1]); }),
-};
+// by operator symbol
+static constexpr std::array<BatchKernel, BuiltinCount> batchKernelList = BatchKernels(std::make_index_sequence<BuiltinCount>{});
+
+Calculator::Calculator() {
+    for (const CalcOperator& op : operators) {
+        symbolTrie.Insert(op.name, SymbolKind::SKOperator, Intern(op.name));
+    }
+    for (const CalcOperand& operand : operands) {
+        symbolTrie.Insert(operand.name, SymbolKind::SKOperand, Intern(operand.name));
+    }
+}
+
+int Calculator::Intern(const std::string& name) {
+    int symbol = symbols.Intern(name);
+    if ((size_t) symbol >= variables.size()) {
+        variables.resize(symbol + 1, Last);
+        functions.resize(symbol + 1, Last);
+        dependents.resize(symbol + 1);
+    }
+    return symbol;
+}
+
+void Calculator::Define(const InputLine& line, int handle) {
+    if (line.type != InputLineType::Expression) {
+        trieGeneration++;
+    }
+    if (line.type == InputLineType::ILVariable) {
+        variables[line.symbol] = handle;
+        symbolTrie.Insert(line.identifier, SymbolKind::SKVariable, line.symbol);
+    } else if (line.type == InputLineType::ILFunction) {
+        functions[line.symbol] = handle;
+        symbolTrie.Insert(line.identifier, SymbolKind::SKUserFunction, line.symbol);
+    }
+}
+
+void Calculator::Undefine(const InputLine& line) {
+    if (line.type == InputLineType::ILVariable && variables[line.symbol] != Last) {
+        trieGeneration++;
+        variables[line.symbol] = Last;
+        symbolTrie.Remove(line.identifier, SymbolKind::SKVariable);
+    } else if (line.type == InputLineType::ILFunction && functions[line.symbol] != Last) {
+        trieGeneration++;
+        functions[line.symbol] = Last;
+        symbolTrie.Remove(line.identifier, SymbolKind::SKUserFunction);
+        if (evaluator == EKClosure) {
+            staleClosures.push_back(line.symbol);
+        }
+    }
+}
+
+int Calculator::AddLine(int index) {
+    void* memory;
+    if (freeLines.empty()) {
+        memory = lineArena.Allocate(sizeof(InputLine), alignof(InputLine));
+    } else {
+        memory = freeLines.back();
+        freeLines.pop_back();
+    }
+    InputLine* line = new (memory) InputLine{};
+    line->type = InputLineType::Expression;
+    line->symbol = SymbolTable::None;
+    line->dirty = true;
+    int handle = order.Insert(index);
+    inputs.resize(order.HandleLimit(), nullptr);
+    inputs[handle] = line;
+    return handle;
+}
+
+void Calculator::SetEvaluateLine(int index) {
+    evaluateLine = index == Last ? Last : Handle(index);
+}
 
-static const std::vector<std::string> operatorKeys = getMapKeys(operators);
+// empties a function's call cache, sizing it for the function's current arity
+static void ResetCache(InputLine& function, size_t slots) {
+    CallCache& cache = *function.cache;
+    cache.keys.assign(slots * function.arguments.size(), 0);
+    cache.results.assign(slots, 0);
+    cache.used.assign(slots, false);
+}
+
+static size_t CacheSlot(const double* arguments, size_t count, size_t slots) {
+    uint64_t hash{ 0 };
+    for (size_t i{ 0 }; i < count; i++) {
+        uint64_t bits;
+        std::memcpy(&bits, arguments + i, sizeof(bits));
+        hash = (hash ^ bits) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 29;
+    }
+    // whole numbers and other short doubles only have high bits set, and multiplying only carries bits upwards.
+    // Without folding the top half down they all land in slot 0
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    return hash % slots;
+}
 
-void Calculator::AddLine(int index) {
-    if (index <= evaluateLine) {
-        evaluateLine++;
+void Calculator::SetCacheSize(size_t slots) {
+    cacheSize = slots;
+    for (InputLine* line : inputs) {
+        if (line != nullptr && line->cache != nullptr) {
+            ResetCache(*line, slots);
+        }
     }
-    inputs.insert(inputs.begin() + index, new InputLine{});
 }
 
-void Calculator::SetEvaluateLine(int line) {
-    evaluateLine = line;
+CacheStats Calculator::GetCacheStats(int index) {
+    InputLine& line = *inputs[Handle(index)];
+    if (line.cache == nullptr) {
+        return CacheStats{ 0, 0, 0 };
+    }
+    std::lock_guard<std::mutex> guard{ line.cache->lock };
+    return CacheStats{ line.cache->hits, line.cache->misses, (size_t) std::count(line.cache->used.begin(), line.cache->used.end(), true) };
 }
 
 void Calculator::RemoveLine(int index) {
-    if (index == evaluateLine) {
+    int handle = Handle(index);
+    if (handle == evaluateLine) {
         evaluateLine = Last;
     }
-    InputLine* input = inputs.at(index);
-    if (input->type == InputLineType::ILVariable) {
-        variables.erase(input->identifier);
-    } else if (input->type == InputLineType::ILFunction) {
-        functions.erase(input->identifier);
+    InputLine* input = inputs[handle];
+    Undefine(*input);
+    SetReferences(input, {});
+    if (input->type != InputLineType::Expression) {
+        Invalidate(input->symbol);
+    }
+    input->~InputLine();
+    freeLines.push_back(input);
+    inputs[handle] = nullptr;
+    order.Remove(handle);
+}
+
+// marks everything downstream of symbol as needing recalculation.
+// a clean line only ever depends on clean lines, so the walk can stop at lines that are already dirty
+void Calculator::Invalidate(int symbol) {
+    std::vector<InputLine*> pending(dependents[symbol].begin(), dependents[symbol].end());
+    while (!pending.empty()) {
+        InputLine* line = pending.back();
+        pending.pop_back();
+        if (line->dirty) {
+            continue;
+        }
+        line->dirty = true;
+        if (line->type != InputLineType::Expression) {
+            pending.insert(pending.end(), dependents[line->symbol].begin(), dependents[line->symbol].end());
+        }
+    }
+}
+
+void Calculator::SetReferences(InputLine* line, const std::vector<int>& references) {
+    for (int symbol : line->references) {
+        dependents[symbol].erase(line);
+    }
+    line->references = references;
+    for (int symbol : references) {
+        dependents[symbol].insert(line);
     }
-    delete input;
-    inputs.erase(inputs.begin() + index);
 }
 
 int Calculator::LineCount() {
-    return inputs.size();
+    return order.Size();
+}
+
+int Calculator::Handle(int index) {
+    return order.At(index);
+}
+
+int Calculator::GetLineHandle(int index) {
+    return order.At(index);
+}
+
+int Calculator::GetLineIndex(int handle) {
+    return order.Position(handle);
+}
+
+const InputLine& Calculator::GetLine(int index) {
+    return *inputs[Handle(index)];
+}
+
+std::vector<int> Calculator::GetDependentLines(const std::vector<int>& symbols) {
+    std::set<InputLine*> found{};
+    std::vector<int> pending(symbols);
+    while (!pending.empty()) {
+        int symbol = pending.back();
+        pending.pop_back();
+        if (symbol < 0 || (size_t) symbol >= dependents.size()) {
+            continue;
+        }
+        for (InputLine* line : dependents[symbol]) {
+            if (found.insert(line).second && line->type != InputLineType::Expression) {
+                pending.push_back(line->symbol);
+            }
+        }
+    }
+    std::vector<int> lines{};
+    for (size_t handle{ 0 }; handle < inputs.size(); handle++) {
+        if (inputs[handle] != nullptr && (inputs[handle]->failed || found.count(inputs[handle]) != 0)) {
+            lines.push_back(GetLineIndex(handle));
+        }
+    }
+    std::sort(lines.begin(), lines.end());
+    return lines;
 }
 
 // postfix operators get treated differently anyways
@@ -109,12 +409,26 @@ bool isFunction(ItemType& type) {
     return type == ItemType::Function || type == ItemType::UserFunction;
 }
 
-std::string Calculator::GetFormattedLine(int index) { 
-    InputLine line = *inputs.at(index);
+std::string Calculator::GetFormattedLine(int index) {
+    std::string output{};
+    CalcStatus status = TryGetFormattedLine(index, output);
+    if (!status.Ok()) {
+        Throw(status);
+    }
+    return output;
+}
+
+CalcStatus Calculator::TryGetFormattedLine(int index, std::string& output) {
+    InputLine& line = *inputs[Handle(index)];
+    output.clear();
     if (line.type == InputLineType::Expression) {
-        return std::to_string(EvaluatePostfix(line.postfix));
+        double value;
+        CalcStatus status = TryEvaluateLine(index, value);
+        if (status.Ok()) {
+            output = std::to_string(value);
+        }
+        return status;
     }
-    std::string output{ "" };
     if (line.type != InputLineType::Expression) {
         output += line.identifier;
         if (line.type == InputLineType::ILFunction) {
@@ -131,112 +445,268 @@ std::string Calculator::GetFormattedLine(int index) {
         output += Calculator::Assignment;
         output += " ";
     }
-    std::set<std::string> temp{};
-    for (PostfixItem item : GetExpandedPostfix(line.postfix, temp)) {
+    std::deque<PostfixItem> expanded{};
+    CalcStatus status = TryGetExpandedPostfix(index, expanded);
+    if (!status.Ok()) {
+        output.clear();
+        return status;
+    }
+    for (const PostfixItem& item : expanded) {
         switch (item.type) {
         case ItemType::Function:
         case ItemType::Variable:
         case ItemType::UserFunction:
-            output += item.name;
+        case ItemType::FunctionReference:
+        case ItemType::LoopVariable:
+            output += symbols.Name(item.symbol);
             break;
+        case ItemType::LoopBody:
+            continue;
         case ItemType::Operand:
         case ItemType::OperandSymbol:
             output += std::to_string(item.value);
             break;
+        case ItemType::Other:
+            // parentheses never make it out of the shunting yard
+            output.clear();
+            return Failure(ECInvalidSymbol);
         }
         output += " ";
     }
-    return output;
+    return Success;
 }
 
 void plError(std::string message) {
     throw std::runtime_error(message);
 }
 
-// the idea is given a string "1 + sin(x)" and an index of 3, 
-// need to identify given a list of "sin, cos, *, +, etc" that 
-// the operator (or whatever else needs to be indentified) being used is "sin"
-// returns "" if none valid
-std::string matchToString(const std::string& str, int index, std::vector<std::string> strings) {
-    // the concept is: once a string in strings matches completely, it's added to valid 
-    // and removed from strings. If a string doesn't match then it's just removed from strings. 
-    // Once strings is empty or str has been iterated over, the shortest valid string is taken as a match
-    std::vector<std::string> valid;
-    for (size_t i{ 0 }; i < str.length() - index && !strings.empty(); i++) {
-        size_t j = 0;
-        while (j < strings.size()) { // while loop just for convenience with removing items
-            std::string string = strings[j];
-            if (string.size() <= i) {
-                valid.push_back(string);
-                strings.erase(strings.begin() + j);
-            } else if (string[i] != str[i + index]) {
-                strings.erase(strings.begin() + j);
-            } else {
-                j++;
-            }
+std::string Calculator::GetErrorMessage(const CalcStatus& status) {
+    switch (status.code) {
+    case ECNone: return "";
+    case ECExpectedName: return "Expected alphabetical or (";
+    case ECEmptyArgument: return "Argument name length cannot be 0";
+    case ECExpectedArgument: return "Expected alphabetical, ',', or )";
+    case ECEmptyIdentifier: return "Identifier length cannot be 0";
+    case ECDefinedTwice: return symbols.Name(status.symbol) + " cannot be defined twice";
+    case ECTwoDecimalPoints: return "Cannot parse value, two '.' in a row";
+    case ECUnknownIdentifier: return "Unknown identifier at index " + std::to_string(status.position);
+    case ECMismatchedParentheses: return "Mismatched parentheses";
+    case ECInvalidSymbol: return "Invalid symbol";
+    case ECUndefined: return symbols.Name(status.symbol) + " isn't well defined";
+    case ECMissingArguments: return "Missing arguments";
+    case ECRecursion: return "Recursion detected";
+    case ECVariableRecursion: return "Recursion detected with variables";
+    case ECWrongArgumentCount: return "Wrong number of arguments for an operator/function";
+    case ECCancelled: return "Evaluation cancelled";
+    case ECExpectedFunction: return "solve and minimize take a function name first";
+    case ECSolveArguments: return symbols.Name(status.symbol) + " needs exactly one argument to be solved";
+    case ECNoRoot: return "No solution found for " + symbols.Name(status.symbol);
+    case ECNoMinimum: return "No minimum found for " + symbols.Name(status.symbol);
+    case ECNotDifferentiable: return "Cannot differentiate through solve or minimize";
+    case ECExpectedLoopVariable: return "sum and integrate take an expression and a variable name first";
+    case ECFunctionLine: return "Only variables and expressions can be evaluated";
+    case ECNoIntegral: return "Integral did not converge";
+    case ECBoundSolve: return symbols.Name(status.symbol) + " cannot be solved with bound variables";
+    case ECBoundLoop: return "sum and integrate cannot use bound variables";
+    case ECColumnCount: return "Every bound variable needs a column of values";
+    case ECColumnLength: return "Columns must all be the same length";
+    case ECInexactBounds: return "sum needs bounds that are known exactly";
+    }
+    return "Unknown error";
+}
+
+// the throwing API on top of the Try functions
+void Calculator::Throw(const CalcStatus& status) {
+    if (status.code == ECCancelled) {
+        throw EvaluationCancelled{};
+    }
+    plError(GetErrorMessage(status));
+}
+
+// the current line's arguments are only tokenizable while its right hand side is being parsed
+struct ArgumentScope {
+    SymbolTrie& symbolTrie;
+    const InputLine& line;
+
+    ArgumentScope(SymbolTrie& symbolTrie, const InputLine& line) : symbolTrie{ symbolTrie }, line{ line } {
+        for (size_t i{ 0 }; i < line.arguments.size(); i++) {
+            symbolTrie.Insert(line.arguments[i], SymbolKind::SKVariable, line.argumentSymbols[i]);
+        }
+    }
+
+    ~ArgumentScope() {
+        for (const std::string& argument : line.arguments) {
+            symbolTrie.Remove(argument, SymbolKind::SKVariable);
         }
     }
-    for (std::string s : strings) {
-        if (str.substr(index, str.length()) == s) {
-            valid.push_back(s);
+};
+
+// the variables bound by the sums and integrals of the line being parsed, tokenizable until the parse ends
+struct LoopScope {
+    struct Binding {
+        std::string name;
+        int symbol;
+        size_t position; // where the name is in the line
+    };
+
+    SymbolTrie& symbolTrie;
+    std::vector<Binding> bindings{};
+
+    explicit LoopScope(SymbolTrie& symbolTrie) : symbolTrie{ symbolTrie } {
+    }
+
+    void Bind(const std::string& name, int symbol, size_t position) {
+        symbolTrie.Insert(name, SymbolKind::SKVariable, symbol);
+        bindings.push_back(Binding{ name, symbol, position });
+    }
+
+    ~LoopScope() {
+        for (const Binding& binding : bindings) {
+            symbolTrie.Remove(binding.name, SymbolKind::SKVariable);
         }
     }
-    std::string longest = "";
-    for (std::string s : valid) {
-        if (s.size() > longest.size()) {
-            longest = s;
+};
+
+// a sum or integrate binds its second argument, which has to be known before the first is read. Given the index just
+// past the call's (, returns where the second argument's name starts, or npos when it isn't just a name
+static size_t FindLoopVariable(std::string_view str, size_t i, size_t& length) {
+    int depth{ 0 };
+    for (; i < str.size() && !(str[i] == ',' && depth == 0); i++) {
+        if (str[i] == '(') {
+            depth++;
+        } else if (str[i] == ')' && depth-- == 0) {
+            return std::string_view::npos;
         }
     }
-    return longest;
+    size_t begin = str.find_first_not_of(" \t", i + 1);
+    if (i == str.size() || begin == std::string_view::npos) {
+        return std::string_view::npos;
+    }
+    size_t end = begin;
+    while (end < str.size() && isalpha(str[end])) {
+        end++;
+    }
+    size_t next = str.find_first_not_of(" \t", end);
+    if (end == begin || next == std::string_view::npos || str[next] != ',') {
+        return std::string_view::npos;
+    }
+    length = end - begin;
+    return begin;
+}
+
+// one token of a line's right hand side, or a * it implies or the start of a loop body it begins, and where shunting
+// yard was when it got to it
+struct LineToken {
+    PostfixItem item;
+    OpType type;
+    size_t begin; // in the line, an implied * or loop body gets the span of the token it comes with
+    size_t end;
+    size_t seen; // one past the last character tokenizing it looked at, edits from there on don't change it
+    size_t reach; // the furthest seen of it and every token before it
+    size_t output; // postfix items before it
+    int stack; // the operator stack before it
+};
+
+// a line's tokens along with the shunting yard state before each, so an edit can tokenize again from the first token
+// that looked at the edited text and stop shunting once it's back on the track of the last parse. The operator stack
+// is persistent: a push adds a node pointing at the one below and a pop goes back to that, so any stack there has
+// been is one index into nodes
+struct LineTokens {
+    struct StackNode {
+        PostfixItem item;
+        int below;
+    };
+
+    static const int Empty = -1;
+
+    std::vector<LineToken> tokens;
+    std::vector<LineToken> previous; // while an edit is being applied, the tokens from the first one it changes on
+    std::vector<StackNode> nodes;
+    std::vector<PostfixItem> produced; // scratch for the postfix shunting yard makes between the parts it keeps
+    size_t start{ 0 }; // where the right hand side begins
+    size_t output{ 0 }; // postfix items before the stack got emptied at the end
+    int stack{ Empty }; // the stack that got emptied
+    int balance{ 0 }; // ( minus )
+    uint64_t generation{ 0 }; // of the symbols the tokens were matched against
+    bool loops{ false }; // sums and integrals bind variables further along the line, edits to those lines parse it all
+    bool valid{ false }; // the tokens go with the line's text and postfix
+};
+
+const int LineTokens::Empty;
+
+CalcStatus Calculator::TryParseLine(std::string_view str, int index) {
+    return TryParse(str, Handle(index));
 }
 
-void Calculator::ParseLine(const std::string& str, int lineIndex) {
+CalcStatus Calculator::TryParse(std::string_view str, int handle) {
     // update references of old line
-    InputLine& previous = *inputs.at(lineIndex);
-    previous.failed = true;
-    if (previous.type == InputLineType::ILVariable) {
-        variables.erase(previous.identifier);
-    } else if (previous.type == InputLineType::ILFunction) {
-        functions.erase(previous.identifier);
+    InputLine& line = *inputs[handle];
+    if (profiling) {
+        line.counters.parses++;
+        if (line.failed && line.source == str) {
+            line.counters.reparses++;
+        }
+    }
+    ProfileTimer timer{ profiling ? &line.counters.parseTime : nullptr };
+    line.failed = true;
+    line.dirty = true;
+    line.closure.reset();
+    if (line.tokens != nullptr) {
+        line.tokens->valid = false;
+    }
+    Undefine(line);
+    if (line.type != InputLineType::Expression) {
+        Invalidate(line.symbol);
     }
+    // the line is rebuilt in place, so its buffers keep their capacity from the last parse
+    line.type = InputLineType::Expression;
+    line.identifier.clear();
+    line.symbol = SymbolTable::None;
+    line.arguments.clear();
+    line.argumentSymbols.clear();
+    line.postfix.clear();
+    // store the incompletion state
+    line.source = str;
     // parse left hand of = sign
-    InputLine line{};
-    int assignment = str.find(Calculator::Assignment);
+    size_t assignment = str.find(Calculator::Assignment);
+    size_t start{ 0 };
+    InputLineType type = InputLineType::Expression;
+    std::string name{};
     if (assignment != std::string::npos) {
-        std::string id = str.substr(0, assignment);
+        start = assignment + 1;
         // populate function / variable info
-        std::string name{};
-        std::vector<std::string> arguments{};
+        std::vector<std::string>& arguments = line.arguments;
         int part{ 0 }; // 0: parse name, 1: parse arguments, 2: end
-        for (auto it{ id.begin() }; it < id.end() && part != 2; it++) {
-            if (iswspace(*it)) {
+        for (size_t i{ 0 }; i < assignment && part != 2; i++) {
+            char it = str[i];
+            if (iswspace(it)) {
                 continue;
             }
             switch (part) {
             case 0:
-                if (isalpha(*it)) {
-                    name += *it;
-                } else if (*it == '(') {
+                if (isalpha(it)) {
+                    name += it;
+                } else if (it == '(') {
                     part = 1;
                 } else {
-                    plError("Expected alphabetical or (");
+                    return Failure(ECExpectedName);
                 }
                 break;
             case 1:
-                if (isalpha(*it)) {
+                if (isalpha(it)) {
                     if (arguments.empty()) {
                         arguments.push_back("");
                     }
-                    arguments.back() += *it;
-                } else if (*it == ',') {
+                    arguments.back() += it;
+                } else if (it == ',') {
                     if (arguments.empty() || arguments.back().empty()) {
-                        plError("Argument name length cannot be 0");
+                        return Failure(ECEmptyArgument);
                     }
                     arguments.push_back("");
-                } else if (*it == ')') {
+                } else if (it == ')') {
                     part = 2;
                 } else {
-                    plError("Expected alphabetical, ',', or )");
+                    return Failure(ECExpectedArgument);
                 }
                 break;
             }
@@ -245,69 +715,134 @@ void Calculator::ParseLine(const std::string& str, int lineIndex) {
             arguments.pop_back();
         }
         if (name.empty()) {
-            plError("Identifier length cannot be 0");
-        } else {
-            line.identifier = name;
+            return Failure(ECEmptyIdentifier);
         }
-        if (arguments.empty()) {
-            line.type = InputLineType::ILVariable;
-        } else {
-            line.type = InputLineType::ILFunction;
-            line.arguments = arguments;
+        type = arguments.empty() ? InputLineType::ILVariable : InputLineType::ILFunction;
+    }
+    int symbol = SymbolTable::None;
+    if (type != InputLineType::Expression) {
+        symbol = Intern(name);
+        // update references even if the left hand side might not be valid
+        if (variables[symbol] != Last || functions[symbol] != Last) {
+            return Failure(ECDefinedTwice, -1, symbol);
         }
-    } else {
-        line.type = InputLineType::Expression;
     }
-    // update references even if the left hand side might not be valid
-    if (variables.find(line.identifier) != variables.end() || functions.find(line.identifier) != functions.end()) {
-        plError(line.identifier + " cannot be defined twice");
+    for (const std::string& argument : line.arguments) {
+        line.argumentSymbols.push_back(Intern(argument));
     }
-    if (line.type == InputLineType::ILVariable) {
-        variables[line.identifier] = lineIndex;
-    } else if (line.type == InputLineType::ILFunction) {
-        functions[line.identifier] = lineIndex;
+    // only set once registered, so the next parse unregisters exactly what this one registered
+    line.type = type;
+    line.identifier = name;
+    line.symbol = symbol;
+    Define(line, handle);
+    if (line.type != InputLineType::Expression) {
+        Invalidate(line.symbol);
     }
-    // store the incompletion state
-    previous.source = str;
-    // parse the righthand side of the equation
-    std::string righthand;
-    if (assignment == std::string::npos) {
-        righthand = str;
-    } else {
-        righthand = str.substr(assignment + 1, str.size());
-    }
-    std::vector<PostfixItem> items{};
-    std::vector<CalcOperator> ops{};
-    std::deque<PostfixItem> stack{};
-    std::deque<PostfixItem>& output = line.postfix;
-    int parenLCount{ 0 };
-    int parenRCount{ 0 };
-    for (unsigned i{ 0 }; i < righthand.length(); i++) {
-        char it = righthand.at(i);
+    // dirty already, so whatever is in an existing cache gets thrown out before the next call
+    if (line.type == InputLineType::ILFunction && line.cache == nullptr) {
+        line.cache = std::make_unique<CallCache>();
+    }
+    // parse the righthand side of the equation, lines that get edited keep their tokens for the next edit. That
+    // rules out parseArena for them, the others reuse one set of buffers so they stop allocating after the first parse
+    static thread_local LineTokens scratch{};
+    LineTokens& state = line.tokens != nullptr ? *line.tokens : scratch;
+    state.tokens.clear();
+    state.previous.clear();
+    state.nodes.clear();
+    state.start = start;
+    state.balance = 0;
+    state.generation = trieGeneration;
+    state.loops = false;
+    ArgumentScope scope{ symbolTrie, line };
+    size_t kept;
+    CalcStatus status = Tokenize(str, start, str.size(), str.size(), state, kept);
+    if (!status.Ok()) {
+        return status;
+    }
+    Shunt(state, 0, state.tokens.size(), 0, LineTokens::Empty, line.postfix);
+    return FinishParse(line, state);
+}
+
+// tokenizes str from index from on, appending to state.tokens. state.previous can hold the tokens that came next
+// before an edit that ended at oldEditEnd and now ends at editEnd. A token past the edit that starts where one of those
+// did, with the same two tokens before it, comes out just like it did then, so from there on the old tokens get
+// copied over instead. kept is where in previous that happened, its size when it didn't
+CalcStatus Calculator::Tokenize(std::string_view str, size_t from, size_t editEnd, size_t oldEditEnd, LineTokens& state, size_t& kept) {
+    std::vector<LineToken>& tokens = state.tokens;
+    const std::vector<LineToken>& previous = state.previous;
+    size_t first = tokens.size();
+    size_t start = state.start;
+    kept = previous.size();
+    // count places before previous[j] as the tokens were, or before the end of them as they are now
+    auto before = [&](size_t j, size_t count) -> const LineToken* {
+        if (j >= count) {
+            return &previous[j - count];
+        }
+        return first + j >= count ? &tokens[first + j - count] : nullptr;
+    };
+    auto last = [&](size_t count) -> const LineToken* {
+        return tokens.size() >= count ? &tokens[tokens.size() - count] : nullptr;
+    };
+    // all the tokenizer looks at of the tokens before
+    auto same = [](const LineToken* a, const LineToken* b) {
+        if (a == nullptr || b == nullptr) {
+            return a == b;
+        }
+        return a->item.type == b->item.type && a->item.symbol == b->item.symbol && a->type == b->type;
+    };
+    auto append = [&](const LineToken& token) {
+        tokens.push_back(token);
+        if (tokens.size() > 1) {
+            tokens.back().reach = std::max(tokens.back().reach, tokens[tokens.size() - 2].reach);
+        }
+    };
+    LoopScope loops{ symbolTrie };
+    for (size_t i{ from }; i < str.length(); i++) {
+        char it = str[i];
         // first have to identify the next token in the string
-        if (iswspace(it) || it == ',') {
+        if (iswspace(it)) {
             continue;
         }
+        if (i >= editEnd && !previous.empty()) {
+            size_t old = i - editEnd + oldEditEnd;
+            auto match = std::lower_bound(previous.begin(), previous.end(), old, [](const LineToken& token, size_t position) { return token.begin < position; });
+            size_t j = match - previous.begin();
+            if (match != previous.end() && match->begin == old && same(last(1), before(j, 1)) && same(last(2), before(j, 2))) {
+                kept = j;
+                for (; j < previous.size(); j++) {
+                    LineToken token = previous[j];
+                    token.begin = token.begin - oldEditEnd + editEnd;
+                    token.end = token.end - oldEditEnd + editEnd;
+                    token.reach = token.seen = token.seen - oldEditEnd + editEnd;
+                    append(token);
+                }
+                return Success;
+            }
+        }
         PostfixItem item{};
         item.type = ItemType::Other;
-        CalcOperator op{};
-        op.type = OpType::OOther;
-        if (isdigit(it) || it == '.') { // parse number if there is one
-            double operand{ 0 };
+        item.symbol = SymbolTable::None;
+        OpType type = OpType::OOther;
+        size_t begin = i;
+        size_t seen = i + 1;
+        int loopSymbol = SymbolTable::None;
+        auto bound = std::find_if(loops.bindings.begin(), loops.bindings.end(), [i](const LoopScope::Binding& binding) { return binding.position == i; });
+        if (bound != loops.bindings.end()) {
+            item.type = ItemType::LoopVariable;
+            item.symbol = bound->symbol;
+            i += bound->name.size() - 1;
+            seen = i + 1;
+        } else if (isdigit(it) || it == '.') { // parse number if there is one
+            size_t number = i;
             bool leftside{ true };
-            int precision = -1;
-            while (i < righthand.size()) {
-                it = righthand.at(i);
+            bool whole{ false }; // a digit other than 0 in front of the point
+            while (i < str.size()) {
+                it = str[i];
                 if (isdigit(it)) {
-                    if (leftside) {
-                        operand = operand * 10 + it - '0';
-                    } else {
-                        operand += (it - '0') * std::pow(10, precision);
-                        precision--;
-                    }
+                    whole = whole || (leftside && it != '0');
                 } else if (it == '.') {
                     if (!leftside) {
-                        plError("Cannot parse value, two '.' in a row");
+                        return Failure(ECTwoDecimalPoints, i - start);
                     } else {
                         leftside = false;
                     }
@@ -316,216 +851,2604 @@ void Calculator::ParseLine(const std::string& str, int lineIndex) {
                 }
                 i++;
             }
+            // from_chars rounds correctly, so the value is within half an ulp of what was written, and doesn't care
+            // about the locale. Too big is infinity, too small 0 and a lone point 0 as well
+            double operand{ 0 };
+            std::from_chars_result read = std::from_chars(str.data() + number, str.data() + i, operand);
+            if (read.ec == std::errc::result_out_of_range) {
+                operand = whole ? Infinity : 0;
+            } else if (read.ec != std::errc{}) {
+                operand = 0;
+            }
+            // whatever stopped it was looked at too, even the end of the line
+            seen = i + 1;
             i--;
             item.type = ItemType::Operand;
             item.value = operand;
         } else if (it == '(') {
-            item.name = '(';
-            op.type = OpType::ParenthesesL;
-            parenLCount++;
+            type = OpType::ParenthesesL;
+            state.balance++;
+            if (!tokens.empty() && tokens.back().item.type == ItemType::Function && (tokens.back().item.symbol == BSum || tokens.back().item.symbol == BIntegrate)) {
+                state.loops = true;
+                size_t length;
+                size_t position = FindLoopVariable(str, i + 1, length);
+                if (position == std::string_view::npos) {
+                    return Failure(ECExpectedLoopVariable, i - start);
+                }
+                std::string name{ str.substr(position, length) };
+                loopSymbol = Intern(name);
+                loops.Bind(name, loopSymbol, position);
+            }
         } else if (it == ')') {
-            item.name = ')';
-            op.type = OpType::ParenthesesR;
-            parenRCount++;
+            type = OpType::ParenthesesR;
+            state.balance--;
+        } else if (it == ',') {
+            type = OpType::Separator;
         } else {
-            // try to match existing operators to string
-            std::string matchedOperator = matchToString(righthand, i, operatorKeys);
-            std::string matchedOperand = matchToString(righthand, i, operandKeys);
-            std::vector<std::string> variableKeys = getMapKeys(variables);
-            variableKeys.insert(variableKeys.begin(), line.arguments.begin(), line.arguments.end());
-            std::string matchedVariable = matchToString(righthand, i, variableKeys);
-            std::string matchedUserFunction = matchToString(righthand, i, getMapKeys(functions));
-            if (matchedOperator != "") {
-                op = operators.at(matchedOperator);
+            // try to match existing operators to string, the first kind that matches wins
+            SymbolMatch matched[SymbolKindCount];
+            seen = symbolTrie.Match(str, i, matched);
+            size_t matchedLength{ 0 };
+            if (matched[SymbolKind::SKOperator].length != 0) {
+                matchedLength = matched[SymbolKind::SKOperator].length;
                 item.type = ItemType::Function;
-                item.name = matchedOperator;
-            } else if (matchedOperand != "") {
+                item.symbol = matched[SymbolKind::SKOperator].symbol;
+                type = operators[item.symbol].type;
+            } else if (matched[SymbolKind::SKOperand].length != 0) {
+                matchedLength = matched[SymbolKind::SKOperand].length;
                 item.type = ItemType::OperandSymbol;
-                item.value = operands.at(matchedOperand);
-            } else if (matchedVariable != "") {
+                item.value = operands[matched[SymbolKind::SKOperand].symbol - BuiltinCount].value;
+            } else if (matched[SymbolKind::SKVariable].length != 0) {
+                matchedLength = matched[SymbolKind::SKVariable].length;
                 item.type = ItemType::Variable;
-                item.name = matchedVariable;
-            } else if (matchedUserFunction != "") {
-                op.type = OpType::OFunction;
-                item.type = ItemType::UserFunction;
-                item.name = matchedUserFunction;
+                item.symbol = matched[SymbolKind::SKVariable].symbol;
+            } else if (matched[SymbolKind::SKUserFunction].length != 0) {
+                matchedLength = matched[SymbolKind::SKUserFunction].length;
+                item.symbol = matched[SymbolKind::SKUserFunction].symbol;
+                // named right after solve( or minimize( and not called, it's the function to solve
+                size_t next = str.find_first_not_of(" \t", i + matchedLength);
+                seen = std::max(seen, next == std::string_view::npos ? str.size() + 1 : next + 1);
+                if (tokens.size() >= 2 && tokens.back().type == OpType::ParenthesesL &&
+                    tokens[tokens.size() - 2].item.type == ItemType::Function &&
+                    (tokens[tokens.size() - 2].item.symbol == BSolve || tokens[tokens.size() - 2].item.symbol == BMinimize) &&
+                    next != std::string_view::npos && str[next] == ',') {
+                    item.type = ItemType::FunctionReference;
+                } else {
+                    type = OpType::OFunction;
+                    item.type = ItemType::UserFunction;
+                }
             } else {
-                plError("Unknown identifier at index " + std::to_string(i));
-            }
-            int matchedLength = matchedOperator.length() + matchedOperand.length() + matchedVariable.length() + matchedUserFunction.length();
-            i += matchedLength - 1; // if i put it on one line it evaluates as an unsigned int and overflows
-        } 
-        items.push_back(item);
-        ops.push_back(op);
-    }
-    if (parenLCount != parenRCount) {
-        plError("Mismatched parentheses");
-    }
-    // add * when necessary (like 5x = 5*x)
-    for (size_t i{ 1 }; i < items.size(); ++i) {
-        if ((items[i].type == ItemType::OperandSymbol ||
-            items[i].type == ItemType::Variable ||
-            ops[i].type == OpType::ParenthesesL ||
-            ops[i].type == OpType::OFunction) &&
-            (isOperand(items[i-1].type) ||
-            ops[i-1].type == OpType::ParenthesesR)) {
-
-            items.insert(items.begin() + i, PostfixItem{ItemType::Function, "*", 0});
-            ops.insert(ops.begin() + i, operators.at("*"));
-            ++i;
-        }
-    }
-    for (size_t i{ 0 }; i < items.size(); ++i) {
-        PostfixItem item = items[i];
-        CalcOperator op = ops[i];
+                return Failure(ECUnknownIdentifier, i - start);
+            }
+            i += matchedLength - 1;
+        }
+        // add * when necessary (like 5x = 5*x)
+        if (!tokens.empty() &&
+            (item.type == ItemType::OperandSymbol ||
+            item.type == ItemType::Variable ||
+            type == OpType::ParenthesesL ||
+            type == OpType::OFunction) &&
+            (isOperand(tokens.back().item.type) ||
+            tokens.back().type == OpType::ParenthesesR)) {
+
+            append(LineToken{ PostfixItem{ ItemType::Function, BMultiply, 0 }, operators[BMultiply].type, begin, i + 1, seen, seen, 0, 0 });
+        }
+        append(LineToken{ item, type, begin, i + 1, seen, seen, 0, 0 });
+        // the body starts right after the (
+        if (loopSymbol != SymbolTable::None) {
+            append(LineToken{ PostfixItem{ ItemType::LoopBody, loopSymbol, 0 }, OpType::OOther, begin, i + 1, seen, seen, 0, 0 });
+        }
+    }
+    return Success;
+}
+
+// whether two operator stacks hold the same items, which they do from the first node they share on down
+static bool SameStack(const std::vector<LineTokens::StackNode>& nodes, int a, int b) {
+    while (a != b) {
+        if (a == LineTokens::Empty || b == LineTokens::Empty || nodes[a].item.type != nodes[b].item.type || nodes[a].item.symbol != nodes[b].item.symbol) {
+            return false;
+        }
+        a = nodes[a].below;
+        b = nodes[b].below;
+    }
+    return true;
+}
+
+// shunting yard over state.tokens from first on, starting with output items of postfix kept and the operator stack
+// as it was before first. Tokens from synced on were copied from the last parse along with where shunting yard was
+// when it got to them, and once the stack matches that again the rest of the old postfix still holds
+void Calculator::Shunt(LineTokens& state, size_t first, size_t synced, size_t output, int stack, std::deque<PostfixItem>& postfix) {
+    std::vector<LineToken>& tokens = state.tokens;
+    std::vector<LineTokens::StackNode>& nodes = state.nodes;
+    std::vector<PostfixItem>& produced = state.produced;
+    produced.clear();
+    auto push = [&](const PostfixItem& item) {
+        nodes.push_back(LineTokens::StackNode{ item, stack });
+        stack = nodes.size() - 1;
+    };
+    auto pop = [&] {
+        produced.push_back(nodes[stack].item);
+        stack = nodes[stack].below;
+    };
+    for (size_t k{ first }; k < tokens.size(); k++) {
+        LineToken& token = tokens[k];
+        if (k >= synced && SameStack(nodes, stack, token.stack)) {
+            size_t old = token.output;
+            size_t now = output + produced.size();
+            postfix.erase(postfix.begin() + output, postfix.begin() + old);
+            postfix.insert(postfix.begin() + output, produced.begin(), produced.end());
+            for (; k < tokens.size(); k++) {
+                tokens[k].output = tokens[k].output - old + now;
+            }
+            state.output = state.output - old + now;
+            return;
+        }
+        token.output = output + produced.size();
+        token.stack = stack;
+        PostfixItem& item = token.item;
         // finally use shunting yard procedure
-        if (isOperand(item.type)) {
-            output.push_back(item);
+        if (isOperand(item.type) || item.type == ItemType::FunctionReference || item.type == ItemType::LoopBody || item.type == ItemType::LoopVariable) {
+            produced.push_back(item);
         } else if (isFunction(item.type)) {
-            if (op.type == OpType::Postfix) {
-                output.push_back(item);
-            } else if (isOperator(op.type)) {
-                while (!stack.empty() && 
-                    ((stack.back().type == ItemType::Function && operators.at(stack.back().name).precedence >= op.precedence) 
-                    || stack.back().type == ItemType::UserFunction)) {
-                    output.push_back(stack.back());
-                    stack.pop_back();
+            if (token.type == OpType::Postfix) {
+                produced.push_back(item);
+            } else if (isOperator(token.type)) {
+                int precedence = item.type == ItemType::Function ? operators[item.symbol].precedence : 0;
+                while (stack != LineTokens::Empty &&
+                    ((nodes[stack].item.type == ItemType::Function && operators[nodes[stack].item.symbol].precedence >= precedence)
+                    || nodes[stack].item.type == ItemType::UserFunction)) {
+                    pop();
                 }
-                stack.push_back(item);
+                push(item);
             }
         } else {
-            if (op.type == OpType::ParenthesesL) {
-                stack.push_back(item);
-            } else if (op.type == OpType::ParenthesesR) {
-                while (!stack.empty() && stack.back().name[0] != '(') {
-                    output.push_back(stack.back());
-                    stack.pop_back();
+            if (token.type == OpType::ParenthesesL) {
+                push(item);
+            } else if (token.type == OpType::ParenthesesR) {
+                // ( is the only Other that gets pushed
+                while (stack != LineTokens::Empty && nodes[stack].item.type != ItemType::Other) {
+                    pop();
                 }
-                if (!stack.empty()) {
-                    stack.pop_back();
+                if (stack != LineTokens::Empty) {
+                    stack = nodes[stack].below;
+                }
+            } else if (token.type == OpType::Separator) {
+                // finish the argument before the comma, leaving the ( for the rest of the call
+                while (stack != LineTokens::Empty && nodes[stack].item.type != ItemType::Other) {
+                    pop();
                 }
             }
         }
-
     }
-    while (!stack.empty()) {
-        output.push_back(stack.back());
-        stack.pop_back();
+    state.output = output + produced.size();
+    state.stack = stack;
+    // a ( left over fails the line in FinishParse, the rest still goes out so the postfix matches the state
+    for (int node{ stack }; node != LineTokens::Empty; node = nodes[node].below) {
+        if (nodes[node].item.type != ItemType::Other) {
+            produced.push_back(nodes[node].item);
+        }
     }
-    previous = line;
-    previous.failed = false;
-    previous.source = "";
+    postfix.erase(postfix.begin() + output, postfix.end());
+    postfix.insert(postfix.end(), produced.begin(), produced.end());
 }
 
-std::deque<PostfixItem> Calculator::GetExpandedPostfix(std::deque<PostfixItem> items, std::set<std::string>& processed) {
-    size_t i{ 0 };
-    while (i < items.size()) { // replace all the user functions with their expanded forms
-        auto item = items[i];
-        if (item.type == ItemType::UserFunction) {
-            if (functions.find(item.name) == functions.end()) {
-                plError(item.name + " isn't well defined");
-            }
-            auto& function = *inputs[functions[item.name]];
-            auto pCount = function.arguments.size();
-            if (i < pCount) {
-                plError("Missing arguments");
-            }
-            if (processed.find(function.identifier) != processed.end()) {
-                plError("Recursion detected");
-            }
-            // attempt to reparse the function if it's previously failed, like if you define a variable after a function uses it
-            if (function.failed) {
-                ParseLine(function.source, functions[item.name]);
-            }
-            auto processedCopy = processed; // necessary for the recursion detecting to work properly, thinking of the "call stack" as a tree, each vertice should only have a list of its parents
-            processedCopy.insert(function.identifier);
-            auto subItems = GetExpandedPostfix(function.postfix, processedCopy);
-            // replace parameters
-            int j{ 0 };
-            while (items[i + j - pCount].type != ItemType::UserFunction) {
-                for (PostfixItem& item : subItems) {
-                    if (item.name == function.arguments[j]) {
-                        item = items[i + j - pCount];
-                    }
-                }
-                ++j;
-            }
-            // wow this looks disgusting
-            items.insert(items.begin() + i + 1, subItems.begin(), subItems.end());
-            items.erase(items.begin() + i - pCount, items.begin() + i + 1);
-            i += subItems.size() - (pCount + 1);
+// what's left of a parse once the postfix is there, however it got there
+CalcStatus Calculator::FinishParse(InputLine& line, LineTokens& state) {
+    state.valid = true;
+    if (state.balance != 0) {
+        return Failure(ECMismatchedParentheses);
+    }
+    // a ( that never got closed, like in )(
+    for (int node{ state.stack }; node != LineTokens::Empty; node = state.nodes[node].below) {
+        if (state.nodes[node].item.type == ItemType::Other) {
+            return Failure(ECInvalidSymbol);
+        }
+    }
+    CalcStatus compiled = TryCompile(line.postfix, line.argumentSymbols, foldConstants, line.bytecode);
+    if (!compiled.Ok()) {
+        return compiled;
+    }
+    if (evaluator == EKClosure) {
+        line.closure = BuildClosure(line.bytecode);
+        if (line.type == InputLineType::ILFunction) {
+            staleClosures.push_back(line.symbol);
+        }
+    }
+    // the dependency graph only needs touching when the set of references actually changed. The tokens stay with the
+    // line for its next edit, only these are thrown away once the parse is done
+    parseArena.Reset();
+    ArenaVector<int> references{ parseArena };
+    ArenaVector<int> bound{ parseArena }; // variables of the loops the item is in
+    bound.reserve(line.postfix.size());
+    for (const PostfixItem& item : line.postfix) {
+        if (item.type == ItemType::LoopBody) {
+            bound.push_back(item.symbol);
+        } else if (item.type == ItemType::LoopVariable && !bound.empty()) {
+            bound.pop_back();
+        } else if ((item.type == ItemType::Variable || item.type == ItemType::UserFunction || item.type == ItemType::FunctionReference) &&
+            std::find(line.argumentSymbols.begin(), line.argumentSymbols.end(), item.symbol) == line.argumentSymbols.end() &&
+            std::find(bound.begin(), bound.end(), item.symbol) == bound.end()) {
+            references.push_back(item.symbol);
         }
-        ++i;
     }
-    return items;
+    std::sort(references.begin(), references.end());
+    references.erase(std::unique(references.begin(), references.end()), references.end());
+    if (!std::equal(references.begin(), references.end(), line.references.begin(), line.references.end())) {
+        SetReferences(&line, std::vector<int>(references.begin(), references.end()));
+    }
+    line.failed = false;
+    return Success;
 }
 
-std::deque<PostfixItem> Calculator::GetExpandedPostfix(std::deque<PostfixItem> items) {
-    std::set<std::string> temp{};
-    return GetExpandedPostfix(items, temp);
+void Calculator::ParseLine(std::string_view str, int index) {
+    Parse(str, Handle(index));
 }
 
-double Calculator::EvaluatePostfix(std::deque<PostfixItem> items, std::set<std::string>& processedIdentifiers, std::map<std::string, double>& calculatedVariables) {
-    std::set<std::string> temp{};
-    items = GetExpandedPostfix(items, temp);
-    for (PostfixItem& item : items) {
-        if (item.type == ItemType::Variable) {
-            if (variables.find(item.name) == variables.end()) {
-                plError(item.name + " isn't well defined");
-            }
-            if (calculatedVariables.find(item.name) == calculatedVariables.end()) {
-                if (processedIdentifiers.find(item.name) != processedIdentifiers.end()) {
-                    plError("Recursion detected with variables");
-                }
-                if (inputs[variables[item.name]]->failed) {
-                    ParseLine(inputs[variables[item.name]]->source, variables[item.name]);
-                }
-                calculatedVariables[item.name] = EvaluatePostfix(inputs[variables[item.name]]->postfix);
-                processedIdentifiers.insert(item.name); 
-            }
-            item.type = ItemType::Operand;
-            item.value = calculatedVariables.at(item.name);
+void Calculator::Parse(std::string_view str, int handle) {
+    CalcStatus status = TryParse(str, handle);
+    if (!status.Ok()) {
+        Throw(status);
+    }
+}
+
+CalcStatus Calculator::TryEditLine(int index, size_t offset, size_t removed, std::string_view inserted) {
+    int handle = Handle(index);
+    InputLine& line = *inputs[handle];
+    if (offset > line.source.size() || removed > line.source.size() - offset) {
+        throw std::out_of_range("edit outside the line");
+    }
+    std::string text = line.source;
+    text.replace(offset, removed, inserted.data(), inserted.size());
+    if (line.tokens == nullptr) {
+        line.tokens = std::make_unique<LineTokens>();
+        return TryParse(text, handle);
+    }
+    LineTokens& state = *line.tokens;
+    // a pool of stack nodes mostly left behind by earlier edits gets cleared out by parsing it all
+    if (!state.valid || state.generation != trieGeneration || state.loops || offset < state.start ||
+        inserted.find(Calculator::Assignment) != std::string_view::npos || state.nodes.size() > 2 * state.tokens.size() + 64) {
+        return TryParse(text, handle);
+    }
+    ProfileTimer timer{ profiling ? &line.counters.parseTime : nullptr };
+    std::vector<LineToken>& tokens = state.tokens;
+    // the first token that looked at what the edit changed, and the * it implies if any
+    size_t first = std::lower_bound(tokens.begin(), tokens.end(), offset, [](const LineToken& token, size_t position) { return token.reach <= position; }) - tokens.begin();
+    while (first > 0 && first < tokens.size() && tokens[first - 1].begin == tokens[first].begin) {
+        first--;
+    }
+    size_t output = first < tokens.size() ? tokens[first].output : state.output;
+    int stack = first < tokens.size() ? tokens[first].stack : state.stack;
+    size_t from = first < tokens.size() ? std::min(tokens[first].begin, offset) : offset;
+    state.previous.assign(tokens.begin() + first, tokens.end());
+    tokens.resize(first);
+    state.valid = false;
+    size_t kept;
+    CalcStatus status = Success;
+    {
+        ArgumentScope scope{ symbolTrie, line };
+        status = Tokenize(text, from, offset + inserted.size(), offset + removed, state, kept);
+    }
+    if (state.loops) {
+        // the whole parse times itself
+        timer.total = nullptr;
+        return TryParse(text, handle);
+    }
+    if (profiling) {
+        line.counters.parses++;
+    }
+    line.source = std::move(text);
+    line.failed = true;
+    line.dirty = true;
+    line.closure.reset();
+    // same name, but whatever reads it is out of date
+    if (line.type != InputLineType::Expression) {
+        Invalidate(line.symbol);
+    }
+    if (!status.Ok()) {
+        // a full parse that fails here has cleared the postfix already, formatting the line shows what's left of it
+        line.postfix.clear();
+        return status;
+    }
+    for (size_t j{ 0 }; j < kept; j++) {
+        if (state.previous[j].type == OpType::ParenthesesL) {
+            state.balance--;
+        } else if (state.previous[j].type == OpType::ParenthesesR) {
+            state.balance++;
         }
     }
-    size_t i{ 0 };
-    while (items.size() > 1 && i < items.size()) {
-        switch (items[i].type) {
-        case ItemType::OperandSymbol:
-            items[i].type = ItemType::Operand;
+    Shunt(state, first, tokens.size() - (state.previous.size() - kept), output, stack, line.postfix);
+    return FinishParse(line, state);
+}
+
+void Calculator::EditLine(int index, size_t offset, size_t removed, std::string_view inserted) {
+    CalcStatus status = TryEditLine(index, offset, removed, inserted);
+    if (!status.Ok()) {
+        Throw(status);
+    }
+}
+
+// appends items to output with every user function call replaced by the callee's body. arguments holds the already
+// expanded values of the current function's arguments, starts the output index where each value on the stack begins
+CalcStatus Calculator::ExpandPostfix(const std::deque<PostfixItem>& items, const std::vector<int>& argumentSymbols, const std::vector<std::vector<PostfixItem>>& arguments,
+    std::vector<PostfixItem>& output, std::vector<size_t>& starts, std::vector<int>& processed) {
+    std::vector<int> bound{}; // variables of the loops the item is in, they shadow the arguments
+    for (const PostfixItem& item : items) {
+        switch (item.type) {
+        case ItemType::Variable: {
+            size_t start = output.size();
+            auto argument = std::find(argumentSymbols.begin(), argumentSymbols.end(), item.symbol);
+            if (argument != argumentSymbols.end() && std::find(bound.begin(), bound.end(), item.symbol) == bound.end()) {
+                const std::vector<PostfixItem>& value = arguments[argument - argumentSymbols.begin()];
+                output.insert(output.end(), value.begin(), value.end());
+            } else {
+                output.push_back(item);
+            }
+            starts.push_back(start);
             break;
-        case ItemType::Variable:
-        case ItemType::UserFunction:
-        case ItemType::Other:
-            plError("Invalid symbol");
+        }
+        case ItemType::Function: {
+            size_t argumentCount = std::min<size_t>(starts.size(), operators[item.symbol].argumentCount);
+            size_t start = argumentCount == 0 ? output.size() : starts[starts.size() - argumentCount];
+            starts.resize(starts.size() - argumentCount);
+            output.push_back(item);
+            starts.push_back(start);
             break;
-        case ItemType::Function:
-            size_t argCount = operators.at(items[i].name).argumentCount;
-            if (i < argCount) {
-                plError("Wrong number of arguments for an operator/function");
+        }
+        case ItemType::UserFunction: {
+            if (functions[item.symbol] == Last) {
+                return Failure(ECUndefined, -1, item.symbol);
             }
-            std::vector<double> arguments{};
-            for (size_t j{ i - argCount }; j < i; ++j) {
-                if (items[j].type != ItemType::Operand) {
-                    plError("Wrong number of arguments for an operator/function");
+            // attempt to reparse the function if it's previously failed, like if you define a variable after a function uses it
+            if (inputs[functions[item.symbol]]->failed) {
+                CalcStatus status = TryParse(inputs[functions[item.symbol]]->source, functions[item.symbol]);
+                if (!status.Ok()) {
+                    return status;
                 }
-                arguments.push_back(items[j].value);
             }
-            double result = operators.at(items[i].name).function(arguments);
-            items.insert(items.begin() + i + 1, PostfixItem{ ItemType::Operand, "", result });
-            items.erase(items.begin() + i - argCount, items.begin() + i + 1);
-            i -= argCount;
+            const InputLine& function = *inputs[functions[item.symbol]];
+            if (Cancelled()) {
+                return Failure(ECCancelled);
+            }
+            size_t pCount = function.arguments.size();
+            if (starts.size() < pCount) {
+                return Failure(ECMissingArguments);
+            }
+            if (std::find(processed.begin(), processed.end(), item.symbol) != processed.end()) {
+                return Failure(ECRecursion);
+            }
+            // the arguments are already expanded, take them off the output and substitute them into the body
+            size_t start = pCount == 0 ? output.size() : starts[starts.size() - pCount];
+            std::vector<std::vector<PostfixItem>> values(pCount);
+            for (size_t j{ 0 }; j < pCount; j++) {
+                size_t end = j + 1 < pCount ? starts[starts.size() - pCount + j + 1] : output.size();
+                values[j].assign(output.begin() + starts[starts.size() - pCount + j], output.begin() + end);
+            }
+            output.resize(start);
+            starts.resize(starts.size() - pCount);
+            size_t depth = starts.size();
+            processed.push_back(item.symbol);
+            CalcStatus status = ExpandPostfix(function.postfix, function.argumentSymbols, values, output, starts, processed);
+            if (!status.Ok()) {
+                return status;
+            }
+            processed.pop_back();
+            // the body is one value, however it's spelled
+            starts.resize(depth);
+            starts.push_back(start);
+            break;
+        }
+        case ItemType::LoopBody:
+        case ItemType::LoopVariable:
+            if (item.type == ItemType::LoopBody) {
+                bound.push_back(item.symbol);
+            } else if (!bound.empty()) {
+                bound.pop_back();
+            }
+            output.push_back(item);
+            starts.push_back(output.size() - 1);
             break;
+        default:
+            output.push_back(item);
+            starts.push_back(output.size() - 1);
         }
-        ++i;
     }
-    if (items.size() != 1) {
-        plError("Wrong number of arguments for an operator/function");
+    return Success;
+}
+
+std::deque<PostfixItem> Calculator::GetExpandedPostfix(const std::deque<PostfixItem>& items) {
+    std::vector<PostfixItem> output{};
+    std::vector<size_t> starts{};
+    std::vector<int> processed{};
+    CalcStatus status = ExpandPostfix(items, {}, {}, output, starts, processed);
+    if (!status.Ok()) {
+        Throw(status);
+    }
+    return std::deque<PostfixItem>(output.begin(), output.end());
+}
+
+std::deque<PostfixItem> Calculator::GetExpandedPostfix(int index) {
+    std::deque<PostfixItem> expanded{};
+    CalcStatus status = TryGetExpandedPostfix(index, expanded);
+    if (!status.Ok()) {
+        Throw(status);
+    }
+    return expanded;
+}
+
+CalcStatus Calculator::TryGetExpandedPostfix(int index, std::deque<PostfixItem>& expanded) {
+    InputLine& line = *inputs[Handle(index)];
+    ProfileTimer timer{ profiling ? &line.counters.expandTime : nullptr };
+    std::vector<PostfixItem> output{};
+    std::vector<size_t> starts{};
+    std::vector<int> processed{};
+    CalcStatus status = ExpandPostfix(line.postfix, {}, {}, output, starts, processed);
+    if (!status.Ok()) {
+        return status;
+    }
+    expanded.assign(output.begin(), output.end());
+    if (profiling) {
+        line.counters.expandedTokens = expanded.size();
+    }
+    return Success;
+}
+
+void Calculator::SetProfiling(bool enabled) {
+    if (enabled && !profiling) {
+        for (InputLine* line : inputs) {
+            if (line == nullptr) {
+                continue;
+            }
+            line->counters.parseTime = 0;
+            line->counters.parses = 0;
+            line->counters.reparses = 0;
+            line->counters.expandTime = 0;
+            line->counters.expandedTokens = 0;
+            line->counters.evaluateTime = 0;
+            line->counters.evaluations = 0;
+        }
     }
-    return items[0].value;
+    profiling = enabled;
+}
+
+bool Calculator::IsProfiling() {
+    return profiling;
 }
 
-double Calculator::EvaluatePostfix(std::deque<PostfixItem> items) {
-    std::set<std::string> temp1{};
-    std::map<std::string, double> temp2{};
-    return EvaluatePostfix(items, temp1, temp2);
-}
\ No newline at end of file
+LineProfile Calculator::GetLineProfile(int index) {
+    InputLine& line = *inputs[Handle(index)];
+    CacheStats cache = GetCacheStats(index);
+    const LineCounters& counters = line.counters;
+    return LineProfile{ counters.parseTime, counters.parses, counters.reparses, counters.expandTime, counters.expandedTokens,
+        counters.evaluateTime, counters.evaluations, cache.hits, cache.misses };
+}
+
+void Calculator::Compile(const std::deque<PostfixItem>& items, const std::vector<int>& arguments, Bytecode& program) {
+    CalcStatus status = TryCompile(items, arguments, foldConstants, program);
+    if (!status.Ok()) {
+        Throw(status);
+    }
+}
+
+CalcStatus Calculator::TryCompile(const std::deque<PostfixItem>& items, const std::vector<int>& arguments, bool fold, Bytecode& program) {
+    size_t next{ 0 };
+    CalcStatus status = CompileRange(items, next, arguments, arguments.size(), fold, program);
+    // a loop variable with no body in front of it
+    if (status.Ok() && next != items.size()) {
+        return Failure(ECExpectedLoopVariable);
+    }
+    return status;
+}
+
+// compiles items from next up to the end, or up to the variable that ends the loop body being compiled. The first
+// functionArguments of arguments are the function's, the rest are the variables of the loops the body is in
+CalcStatus Calculator::CompileRange(const std::deque<PostfixItem>& items, size_t& next, const std::vector<int>& arguments, size_t functionArguments, bool fold, Bytecode& program) {
+    program.code.clear();
+    program.constants.clear();
+    program.maxStack = 0;
+    program.argumentCount = arguments.size();
+    program.bodies.clear();
+    size_t depth{ 0 };
+    // function names waiting for their solve or minimize, which always comes after its arguments
+    std::vector<int> solving{};
+    // same for the bodies of sums and integrals
+    std::vector<int> looping{};
+    auto loopVariables = arguments.rend() - functionArguments;
+    for (; next < items.size() && items[next].type != ItemType::LoopVariable; next++) {
+        const PostfixItem& item = items[next];
+        Instruction instruction{};
+        switch (item.type) {
+        case ItemType::Operand:
+        case ItemType::OperandSymbol:
+            instruction = { OpCode::OpConstant, (int) program.constants.size() };
+            program.constants.push_back(item.value);
+            depth++;
+            break;
+        case ItemType::Variable: {
+            // the innermost loop variable wins, then the function's arguments
+            auto loop = std::find(arguments.rbegin(), loopVariables, item.symbol);
+            auto argument = std::find(arguments.begin(), arguments.begin() + functionArguments, item.symbol);
+            if (loop != loopVariables) {
+                instruction = { OpCode::OpArgument, (int) (arguments.rend() - loop - 1) };
+            } else if (argument != arguments.begin() + functionArguments) {
+                instruction = { OpCode::OpArgument, (int) (argument - arguments.begin()) };
+            } else {
+                instruction = { OpCode::OpVariable, item.symbol };
+            }
+            depth++;
+            break;
+        }
+        case ItemType::Function: {
+            if (item.symbol == BSolve || item.symbol == BMinimize) {
+                if (solving.empty()) {
+                    return Failure(ECExpectedFunction);
+                }
+                instruction = { item.symbol == BSolve ? OpCode::OpSolve : OpCode::OpMinimize, solving.back() };
+                solving.pop_back();
+                depth -= std::min<size_t>(depth, operators[item.symbol].argumentCount - 2);
+                break;
+            }
+            if (item.symbol == BSum || item.symbol == BIntegrate) {
+                if (looping.empty()) {
+                    return Failure(ECExpectedLoopVariable);
+                }
+                instruction = { item.symbol == BSum ? OpCode::OpSum : OpCode::OpIntegrate, looping.back() };
+                looping.pop_back();
+                // only the bounds are on the stack
+                depth -= std::min<size_t>(depth, 1);
+                break;
+            }
+            instruction = { OpCode::OpOperator, item.symbol };
+            depth -= std::min<size_t>(depth, operators[item.symbol].argumentCount - 1);
+            break;
+        }
+        case ItemType::UserFunction:
+            // the callee can be redefined later, so its arity is only checked when it's called
+            instruction = { OpCode::OpCall, item.symbol };
+            depth++;
+            break;
+        case ItemType::FunctionReference:
+            solving.push_back(item.symbol);
+            continue;
+        case ItemType::LoopBody: {
+            std::vector<int> bound{ arguments };
+            bound.push_back(item.symbol);
+            Bytecode body{};
+            next++;
+            CalcStatus status = CompileRange(items, next, bound, functionArguments, fold, body);
+            if (!status.Ok()) {
+                return status;
+            }
+            if (next == items.size() || items[next].symbol != item.symbol) {
+                return Failure(ECExpectedLoopVariable);
+            }
+            looping.push_back(program.bodies.size());
+            program.bodies.push_back(std::move(body));
+            // next is on the variable, which the loop steps past
+            continue;
+        }
+        default:
+            return Failure(ECInvalidSymbol);
+        }
+        program.code.push_back(instruction);
+        program.maxStack = std::max(program.maxStack, depth);
+    }
+    if (!solving.empty()) {
+        return Failure(ECExpectedFunction);
+    }
+    if (!looping.empty()) {
+        return Failure(ECExpectedLoopVariable);
+    }
+    if (fold) {
+        FoldConstants(program);
+    }
+    return Success;
+}
+
+// x + 0 isn't one of the identities, -0 + 0 is +0. Neither is x ^ 1, pow hands back a NaN of its own rather than
+// the one it was given. Subtracting +0 and the rest leave every double alone
+static bool IsIdentity(int symbol, double value, bool right) {
+    if (symbol == BMultiply) {
+        return value == 1;
+    }
+    if (!right) {
+        return false;
+    }
+    if (symbol == BSubtract) {
+        return value == 0 && !std::signbit(value);
+    }
+    return symbol == BDivide && value == 1;
+}
+
+// evaluates operators whose arguments are all constants ahead of time, and drops operators that would leave their
+// argument as it is. Folded operators run the same code they would at evaluation, so results are bit for bit the same
+void Calculator::FoldConstants(Bytecode& program) {
+    std::vector<Instruction> code{};
+    std::vector<double> constants{};
+    // for every value on the stack, the index in code of the constant that pushes it, or Last.
+    // after a call it's unknown how much of the stack the call used, so only what was pushed since is tracked
+    std::vector<int> values{};
+    // removes the constant pushed by code[index], which is always near the end
+    auto removeConstant = [&](int index) {
+        code.erase(code.begin() + index);
+        for (int& value : values) {
+            if (value > index) {
+                value--;
+            }
+        }
+    };
+    for (const Instruction& instruction : program.code) {
+        switch (instruction.code) {
+        case OpCode::OpConstant:
+            values.push_back(code.size());
+            code.push_back({ OpCode::OpConstant, (int) constants.size() });
+            constants.push_back(program.constants[instruction.operand]);
+            break;
+        case OpCode::OpVariable:
+        case OpCode::OpArgument:
+            values.push_back(Last);
+            code.push_back(instruction);
+            break;
+        case OpCode::OpCall:
+        case OpCode::OpSolve:
+        case OpCode::OpMinimize:
+        case OpCode::OpSum:
+        case OpCode::OpIntegrate:
+            values.clear();
+            values.push_back(Last);
+            code.push_back(instruction);
+            break;
+        case OpCode::OpOperator: {
+            size_t count = operators[instruction.operand].argumentCount;
+            if (values.size() < count) {
+                // a malformed expression or one reading past a call, either way Execute has to see it as written
+                values.clear();
+                values.push_back(Last);
+                code.push_back(instruction);
+                break;
+            }
+            bool constant = std::all_of(values.end() - count, values.end(), [](int value) { return value != Last; });
+            if (constant) {
+                double arguments[8];
+                for (size_t j{ 0 }; j < count; j++) {
+                    arguments[j] = constants[code[values[values.size() - count + j]].operand];
+                }
+                double result = Apply(instruction.operand, arguments);
+                // the arguments are the last count instructions, one constant each
+                code.resize(code.size() - count);
+                values.resize(values.size() - count);
+                values.push_back(code.size());
+                code.push_back({ OpCode::OpConstant, (int) constants.size() });
+                constants.push_back(result);
+                break;
+            }
+            if (count == 2) {
+                int left = values[values.size() - 2];
+                int right = values[values.size() - 1];
+                if (right != Last && IsIdentity(instruction.operand, constants[code[right].operand], true)) {
+                    removeConstant(right);
+                    values.pop_back();
+                    break;
+                }
+                if (left != Last && IsIdentity(instruction.operand, constants[code[left].operand], false)) {
+                    removeConstant(left);
+                    values.erase(values.end() - 2);
+                    break;
+                }
+            }
+            values.resize(values.size() - count);
+            values.push_back(Last);
+            code.push_back(instruction);
+            break;
+        }
+        }
+    }
+    program.code = std::move(code);
+    // unused constants are left out
+    std::vector<double> used{};
+    for (Instruction& instruction : program.code) {
+        if (instruction.code == OpCode::OpConstant) {
+            used.push_back(constants[instruction.operand]);
+            instruction.operand = used.size() - 1;
+        }
+    }
+    program.constants = std::move(used);
+}
+
+void Calculator::SetConstantFolding(bool enabled) {
+    foldConstants = enabled;
+    for (InputLine* line : inputs) {
+        if (line != nullptr && !line->failed) {
+            Compile(line->postfix, line->argumentSymbols, line->bytecode);
+            line->closure = evaluator == EKClosure ? BuildClosure(line->bytecode) : nullptr;
+        }
+    }
+}
+
+// looks the arguments up in a function's call cache, emptying the cache first if the function is dirty
+bool Calculator::CacheLookup(InputLine& function, const double* arguments, double& result) {
+    CallCache* cache = function.cache.get();
+    if (cache == nullptr || cacheSize == 0) {
+        return false;
+    }
+    size_t pCount = function.arguments.size();
+    std::lock_guard<std::mutex> guard{ cache->lock };
+    if (function.dirty || cache->keys.size() != cacheSize * pCount) {
+        ResetCache(function, cacheSize);
+    }
+    size_t slot = CacheSlot(arguments, pCount, cacheSize);
+    if (cache->used[slot] && std::memcmp(cache->keys.data() + slot * pCount, arguments, pCount * sizeof(double)) == 0) {
+        cache->hits++;
+        result = cache->results[slot];
+        return true;
+    }
+    cache->misses++;
+    return false;
+}
+
+void Calculator::CacheStore(InputLine& function, const double* arguments, double result) {
+    CallCache* cache = function.cache.get();
+    if (cache == nullptr || cacheSize == 0) {
+        return;
+    }
+    size_t pCount = function.arguments.size();
+    std::lock_guard<std::mutex> guard{ cache->lock };
+    if (cache->keys.size() == cacheSize * pCount) {
+        size_t slot = CacheSlot(arguments, pCount, cacheSize);
+        std::copy_n(arguments, pCount, cache->keys.begin() + slot * pCount);
+        cache->results[slot] = result;
+        cache->used[slot] = true;
+    }
+}
+
+// a user function call that's in progress inside Execute
+struct CallFrame {
+    const Bytecode* program;
+    size_t next; // index of the next instruction
+    size_t frame; // where the arguments start on the stack
+    size_t base; // stack size when the body started
+    InputLine* function;
+    uint64_t started; // clock when the call started, 0 when not profiling
+};
+
+// evaluates program on top of stack into result, frame is where the arguments of the current call start.
+// user function calls don't recurse, every call gets a frame on calls and its body runs in the same loop
+CalcStatus Calculator::Execute(const Bytecode& program, std::vector<double>& stack, size_t frame, std::vector<int>& processed, double& result) {
+    std::vector<CallFrame> calls{};
+    CallFrame current{ &program, 0, frame, stack.size(), nullptr, 0 };
+    while (true) {
+        if (current.next == current.program->code.size()) {
+            if (stack.size() != current.base + 1) {
+                return Failure(ECWrongArgumentCount);
+            }
+            if (calls.empty()) {
+                break;
+            }
+            // everything the function reads has just been calculated. Checked first, during
+            // RecalculateAll the function is already clean and other threads may be reading it
+            if (current.function->dirty) {
+                current.function->dirty = false;
+            }
+            CacheStore(*current.function, stack.data() + current.frame, stack.back());
+            if (current.started != 0) {
+                current.function->counters.evaluateTime += ProfileClock() - current.started;
+                current.function->counters.evaluations++;
+            }
+            // move the result down over the arguments
+            stack[current.frame] = stack.back();
+            stack.resize(current.frame + 1);
+            processed.pop_back();
+            current = calls.back();
+            calls.pop_back();
+            continue;
+        }
+        const Instruction& instruction = current.program->code[current.next++];
+        switch (instruction.code) {
+        case OpCode::OpConstant:
+            stack.push_back(current.program->constants[instruction.operand]);
+            break;
+        case OpCode::OpArgument:
+            stack.push_back(stack[current.frame + instruction.operand]);
+            break;
+        case OpCode::OpVariable: {
+            int variable = variables[instruction.operand];
+            if (variable == Last) {
+                return Failure(ECUndefined, -1, instruction.operand);
+            }
+            double value;
+            CalcStatus status = LineValue(variable, stack, processed, value);
+            if (!status.Ok()) {
+                return status;
+            }
+            stack.push_back(value);
+            break;
+        }
+        case OpCode::OpOperator: {
+            int argumentCount = operators[instruction.operand].argumentCount;
+            if (stack.size() - current.base < (size_t) argumentCount) {
+                return Failure(ECWrongArgumentCount);
+            }
+            double value = Apply(instruction.operand, stack.data() + stack.size() - argumentCount);
+            stack.resize(stack.size() - argumentCount);
+            stack.push_back(value);
+            break;
+        }
+        case OpCode::OpCall: {
+            int definition = functions[instruction.operand];
+            if (definition == Last) {
+                return Failure(ECUndefined, -1, instruction.operand);
+            }
+            // attempt to reparse the function if it's previously failed, like if you define a variable after a function uses it
+            if (inputs[definition]->failed) {
+                CalcStatus status = TryParse(inputs[definition]->source, definition);
+                if (!status.Ok()) {
+                    return status;
+                }
+            }
+            InputLine& function = *inputs[definition];
+            if (Cancelled()) {
+                return Failure(ECCancelled);
+            }
+            size_t pCount = function.arguments.size();
+            if (stack.size() - current.base < pCount) {
+                return Failure(ECMissingArguments);
+            }
+            if (std::find(processed.begin(), processed.end(), instruction.operand) != processed.end()) {
+                return Failure(ECRecursion);
+            }
+            double value;
+            if (CacheLookup(function, stack.data() + stack.size() - pCount, value)) {
+                stack.resize(stack.size() - pCount);
+                stack.push_back(value);
+                break;
+            }
+            processed.push_back(instruction.operand);
+            if (function.closure != nullptr) {
+                // the closure evaluator calls straight into the callee's tree
+                size_t callFrame = stack.size() - pCount;
+                CalcStatus status;
+                {
+                    ProfileTimer timer{ profiling ? &function.counters.evaluateTime : nullptr };
+                    status = Run(function.bytecode, function.closure.get(), stack, callFrame, processed, value);
+                }
+                if (!status.Ok()) {
+                    return status;
+                }
+                if (profiling) {
+                    function.counters.evaluations++;
+                }
+                processed.pop_back();
+                if (function.dirty) {
+                    function.dirty = false;
+                }
+                CacheStore(function, stack.data() + callFrame, value);
+                stack.resize(callFrame);
+                stack.push_back(value);
+                break;
+            }
+            calls.push_back(current);
+            current = CallFrame{ &function.bytecode, 0, stack.size() - pCount, stack.size(), &function, profiling ? ProfileClock() : 0 };
+            break;
+        }
+        case OpCode::OpSolve:
+        case OpCode::OpMinimize: {
+            size_t argumentCount = instruction.code == OpCode::OpSolve ? 2 : 1;
+            if (stack.size() - current.base < argumentCount) {
+                return Failure(ECWrongArgumentCount);
+            }
+            // the solver pushes onto the stack, so the arguments are copied out first
+            double target = stack[stack.size() - argumentCount];
+            double guess = stack.back();
+            stack.resize(stack.size() - argumentCount);
+            double value;
+            CalcStatus status = Solve(instruction.code, instruction.operand, target, guess, stack, processed, value);
+            if (!status.Ok()) {
+                return status;
+            }
+            stack.push_back(value);
+            break;
+        }
+        case OpCode::OpSum:
+        case OpCode::OpIntegrate: {
+            if (stack.size() - current.base < 2) {
+                return Failure(ECWrongArgumentCount);
+            }
+            double low = stack[stack.size() - 2];
+            double high = stack.back();
+            stack.resize(stack.size() - 2);
+            double value;
+            CalcStatus status = Loop(instruction.code, current.program->bodies[instruction.operand], current.frame, low, high, stack, processed, value);
+            if (!status.Ok()) {
+                return status;
+            }
+            stack.push_back(value);
+            break;
+        }
+        }
+    }
+    result = stack.back();
+    stack.pop_back();
+    return Success;
+}
+
+// a user variable's value in another number type than double, worked out in that type the first time it's read
+template<class T>
+struct TypedLines {
+    std::vector<T> values; // by line
+    std::vector<char> known;
+    std::vector<std::unique_ptr<Bytecode>> programs; // by line, compiled without folding the first time they run
+};
+
+// a program constant in T. An interval takes in everything that could have been rounded to it
+template<class T>
+static T ConstantAs(double x) {
+    return T(x);
+}
+
+template<>
+Interval ConstantAs<Interval>(double x) {
+    return Interval::Around(x);
+}
+
+// what solve, minimize and integrate worked out in double, in T. Nothing is known about how far off those are, so an
+// interval can't do better than everything
+template<class T>
+static T ApproximationAs(double x) {
+    return T(x);
+}
+
+template<>
+Interval ApproximationAs<Interval>(double) {
+    return Interval::Entire();
+}
+
+// whether a T is down to one number, which the bounds of a sum have to be for the terms to be known
+template<class T>
+static bool IsPoint(const T&) {
+    return true;
+}
+
+static bool IsPoint(const Interval& x) {
+    return x.low == x.high || x.IsNaN();
+}
+
+// the double solve, minimize and integrate start from. Their result is everything for an interval anyway, so any
+// number in it will do
+template<class T>
+static double EstimateOf(const T& x) {
+    return Primal(x);
+}
+
+static double EstimateOf(const Interval& x) {
+    return x.IsNaN() || x.low == x.high ? Primal(x) : x.low / 2 + x.high / 2;
+}
+
+// the program a line runs in T. Folding has worked the constants out in double, so unless T is double, or dual numbers
+// for the solver that only want the slopes, lines get compiled again without it the first time they're run
+template<class T>
+CalcStatus Calculator::ProgramAs(int handle, TypedLines<T>& lines, const Bytecode*& program) {
+    InputLine& line = *inputs[handle];
+    if (std::is_same<T, double>::value || IsDual<T>::value || !foldConstants) {
+        program = &line.bytecode;
+        return Success;
+    }
+    if (!lines.programs[handle]) {
+        auto unfolded = std::make_unique<Bytecode>();
+        CalcStatus status = TryCompile(line.postfix, line.argumentSymbols, false, *unfolded);
+        if (!status.Ok()) {
+            return status;
+        }
+        lines.programs[handle] = std::move(unfolded);
+    }
+    program = lines.programs[handle].get();
+    return Success;
+}
+
+// Execute on other types than double. For the solver those are dual numbers, so the result carries its derivatives
+// along with it, variables are constants as far as the derivatives go and lines only holds nothing. For EvaluateLineAs
+// they're plain numbers, and variables get calculated in T too, once per evaluation, in lines. Either way calls run
+// the callee's body the same way. values is the stack, with the arguments of the current call starting at frame.
+// stack is only for the evaluations that still happen in double
+template<class T>
+CalcStatus Calculator::ExecuteAs(const Bytecode& program, std::vector<T>& values, size_t frame, std::vector<double>& stack, std::vector<int>& processed, TypedLines<T>& lines, T& result) {
+    size_t base = values.size();
+    for (const Instruction& instruction : program.code) {
+        switch (instruction.code) {
+        case OpCode::OpConstant:
+            values.push_back(ConstantAs<T>(program.constants[instruction.operand]));
+            break;
+        case OpCode::OpArgument: {
+            T argument = values[frame + instruction.operand];
+            values.push_back(argument);
+            break;
+        }
+        case OpCode::OpVariable: {
+            int variable = variables[instruction.operand];
+            if (variable == Last) {
+                return Failure(ECUndefined, -1, instruction.operand);
+            }
+            if constexpr (IsDual<T>::value) {
+                double value;
+                CalcStatus status = LineValue(variable, stack, processed, value);
+                if (!status.Ok()) {
+                    return status;
+                }
+                values.push_back(T(value));
+            } else {
+                T value;
+                CalcStatus status = TypedLineValue(variable, values, stack, processed, lines, value);
+                if (!status.Ok()) {
+                    return status;
+                }
+                values.push_back(value);
+            }
+            break;
+        }
+        case OpCode::OpOperator: {
+            int argumentCount = operators[instruction.operand].argumentCount;
+            if (values.size() - base < (size_t) argumentCount) {
+                return Failure(ECWrongArgumentCount);
+            }
+            T value = Apply(instruction.operand, values.data() + values.size() - argumentCount);
+            values.resize(values.size() - argumentCount);
+            values.push_back(value);
+            break;
+        }
+        case OpCode::OpCall: {
+            int definition = functions[instruction.operand];
+            if (definition == Last) {
+                return Failure(ECUndefined, -1, instruction.operand);
+            }
+            if (inputs[definition]->failed) {
+                CalcStatus status = TryParse(inputs[definition]->source, definition);
+                if (!status.Ok()) {
+                    return status;
+                }
+            }
+            InputLine& function = *inputs[definition];
+            if (Cancelled()) {
+                return Failure(ECCancelled);
+            }
+            size_t pCount = function.arguments.size();
+            if (values.size() - base < pCount) {
+                return Failure(ECMissingArguments);
+            }
+            if (std::find(processed.begin(), processed.end(), instruction.operand) != processed.end()) {
+                return Failure(ECRecursion);
+            }
+            const Bytecode* body;
+            CalcStatus status = ProgramAs(definition, lines, body);
+            if (!status.Ok()) {
+                return status;
+            }
+            size_t callFrame = values.size() - pCount;
+            processed.push_back(instruction.operand);
+            T value;
+            status = ExecuteAs(*body, values, callFrame, stack, processed, lines, value);
+            if (!status.Ok()) {
+                return status;
+            }
+            processed.pop_back();
+            // only a dual run has calculated the variables the function reads the usual way
+            if (IsDual<T>::value && function.dirty) {
+                function.dirty = false;
+            }
+            values.resize(callFrame);
+            values.push_back(value);
+            break;
+        }
+        case OpCode::OpSum: {
+            if (values.size() - base < 2) {
+                return Failure(ECWrongArgumentCount);
+            }
+            // the bounds only pick which terms there are, they don't carry a derivative
+            if (!IsPoint(values[values.size() - 2]) || !IsPoint(values.back())) {
+                return Failure(ECInexactBounds);
+            }
+            double low = Primal(values[values.size() - 2]);
+            double high = Primal(values.back());
+            values.resize(values.size() - 2);
+            const Bytecode& body = program.bodies[instruction.operand];
+            size_t loopFrame = values.size();
+            for (size_t j{ 0 }; j + 1 < body.argumentCount; j++) {
+                T argument = values[frame + j];
+                values.push_back(argument);
+            }
+            values.push_back(T(low));
+            T sum(std::isfinite(low) && std::isfinite(high) ? 0 : NaN);
+            for (double k{ low }; k <= high && k + 1 != k; k++) {
+                if (Cancelled()) {
+                    return Failure(ECCancelled);
+                }
+                values.back() = T(k);
+                T term;
+                CalcStatus status = ExecuteAs(body, values, loopFrame, stack, processed, lines, term);
+                if (!status.Ok()) {
+                    return status;
+                }
+                sum = sum + term;
+            }
+            values.resize(loopFrame);
+            values.push_back(sum);
+            break;
+        }
+        case OpCode::OpSolve:
+        case OpCode::OpMinimize: {
+            if constexpr (IsDual<T>::value) {
+                return Failure(ECNotDifferentiable);
+            } else {
+                size_t argumentCount = instruction.code == OpCode::OpSolve ? 2 : 1;
+                if (values.size() - base < argumentCount) {
+                    return Failure(ECWrongArgumentCount);
+                }
+                // the solver works in double
+                double target = EstimateOf(values[values.size() - argumentCount]);
+                double guess = EstimateOf(values.back());
+                double value;
+                CalcStatus status = Solve(instruction.code, instruction.operand, target, guess, stack, processed, value);
+                if (!status.Ok()) {
+                    return status;
+                }
+                values.resize(values.size() - argumentCount);
+                values.push_back(ApproximationAs<T>(value));
+            }
+            break;
+        }
+        case OpCode::OpIntegrate: {
+            if constexpr (IsDual<T>::value) {
+                return Failure(ECNotDifferentiable);
+            } else {
+                if (values.size() - base < 2) {
+                    return Failure(ECWrongArgumentCount);
+                }
+                // so does the quadrature, on copies of the arguments
+                const Bytecode& body = program.bodies[instruction.operand];
+                size_t arguments = stack.size();
+                for (size_t j{ 0 }; j + 1 < body.argumentCount; j++) {
+                    stack.push_back(EstimateOf(values[frame + j]));
+                }
+                double value;
+                CalcStatus status = Loop(instruction.code, body, arguments, EstimateOf(values[values.size() - 2]), EstimateOf(values.back()), stack, processed, value);
+                stack.resize(arguments);
+                if (!status.Ok()) {
+                    return status;
+                }
+                values.resize(values.size() - 2);
+                values.push_back(ApproximationAs<T>(value));
+            }
+            break;
+        }
+        }
+    }
+    if (values.size() != base + 1) {
+        return Failure(ECWrongArgumentCount);
+    }
+    result = values.back();
+    values.pop_back();
+    return Success;
+}
+
+// LineValue for EvaluateLineAs, except the values are only kept for the one evaluation
+template<class T>
+CalcStatus Calculator::TypedLineValue(int handle, std::vector<T>& values, std::vector<double>& stack, std::vector<int>& processed, TypedLines<T>& lines, T& value) {
+    if (lines.known[handle]) {
+        value = lines.values[handle];
+        return Success;
+    }
+    if (Cancelled()) {
+        return Failure(ECCancelled);
+    }
+    InputLine& line = *inputs[handle];
+    if (line.failed) {
+        CalcStatus status = TryParse(line.source, handle);
+        if (!status.Ok()) {
+            return status;
+        }
+    }
+    if (line.type == InputLineType::ILFunction) {
+        return Failure(ECFunctionLine);
+    }
+    if (std::find(processed.begin(), processed.end(), line.symbol) != processed.end()) {
+        return Failure(ECVariableRecursion);
+    }
+    const Bytecode* program;
+    CalcStatus status = ProgramAs(handle, lines, program);
+    if (!status.Ok()) {
+        return status;
+    }
+    processed.push_back(line.symbol);
+    status = ExecuteAs(*program, values, values.size(), stack, processed, lines, value);
+    if (!status.Ok()) {
+        return status;
+    }
+    processed.pop_back();
+    lines.values[handle] = value;
+    lines.known[handle] = true;
+    return Success;
+}
+
+// finds where the one argument function symbol equals target, or for OpMinimize where it's lowest, starting from
+// guess. Newton's method runs the body on dual numbers to get exact slopes. When that doesn't converge, or the body
+// has something duals can't go through, Brent's method takes over with plain evaluations. Either way only the
+// compiled body runs, nothing gets parsed or expanded again however many evaluations it takes
+CalcStatus Calculator::Solve(OpCode code, int symbol, double target, double guess, std::vector<double>& stack, std::vector<int>& processed, double& result) {
+    int definition = functions[symbol];
+    if (definition == Last) {
+        return Failure(ECUndefined, -1, symbol);
+    }
+    if (inputs[definition]->failed) {
+        CalcStatus status = TryParse(inputs[definition]->source, definition);
+        if (!status.Ok()) {
+            return status;
+        }
+    }
+    InputLine& function = *inputs[definition];
+    if (function.arguments.size() != 1) {
+        return Failure(ECSolveArguments, -1, symbol);
+    }
+    if (std::find(processed.begin(), processed.end(), symbol) != processed.end()) {
+        return Failure(ECRecursion);
+    }
+    processed.push_back(symbol);
+    ProfileTimer timer{ profiling ? &function.counters.evaluateTime : nullptr };
+    uint64_t evaluations{ 0 };
+    CalcStatus failure = Success; // why the last callback gave up
+    size_t top = stack.size();
+    size_t depth = processed.size();
+    SolverFunction value = [&](double x, double& y) {
+        if (Cancelled()) {
+            failure = Failure(ECCancelled);
+            return false;
+        }
+        evaluations++;
+        stack.push_back(x);
+        failure = Run(function.bytecode, function.closure.get(), stack, top, processed, y);
+        stack.resize(top);
+        // a solve inside the body can fail for some x and not others, to the search that's just x being out of range
+        if (failure.code == ECNoRoot || failure.code == ECNoMinimum || failure.code == ECNoIntegral) {
+            processed.resize(depth);
+            failure = Success;
+            y = NaN;
+        }
+        return failure.Ok();
+    };
+    // minimizing looks for where the slope is 0, so it needs one more derivative
+    std::vector<Dual<double>> duals{};
+    std::vector<Dual<Dual<double>>> secondDuals{};
+    TypedLines<Dual<double>> noLines{};
+    TypedLines<Dual<Dual<double>>> noSecondLines{};
+    SolverSlope slope = [&](double x, double& y, double& dy) {
+        if (Cancelled()) {
+            failure = Failure(ECCancelled);
+            return false;
+        }
+        evaluations++;
+        if (code == OpCode::OpSolve) {
+            Dual<double> fx{};
+            duals.assign(1, Dual<double>(x, 1));
+            failure = ExecuteAs(function.bytecode, duals, 0, stack, processed, noLines, fx);
+            y = fx.value;
+            dy = fx.slope;
+        } else {
+            Dual<Dual<double>> fx{};
+            secondDuals.assign(1, Dual<Dual<double>>(Dual<double>(x, 1), Dual<double>(1, 0)));
+            failure = ExecuteAs(function.bytecode, secondDuals, 0, stack, processed, noSecondLines, fx);
+            y = fx.value.slope;
+            dy = fx.slope.slope;
+        }
+        // a failure can leave calls behind, and Brent's method may still run after it
+        stack.resize(top);
+        processed.resize(depth);
+        return failure.Ok();
+    };
+    SolverOutcome outcome = NewtonRoot(slope, code == OpCode::OpSolve ? target : 0, guess, result);
+    if (outcome == SOFound && code == OpCode::OpMinimize) {
+        // the slope is also 0 at maxima and some inflections, only a minimum curves upwards
+        double y, dy;
+        outcome = slope(result, y, dy) ? (dy > 0 ? SOFound : SONotFound) : SOAborted;
+    }
+    if (outcome == SOAborted && failure.code != ECNotDifferentiable) {
+        return failure;
+    }
+    if (outcome != SOFound) {
+        outcome = code == OpCode::OpSolve ? BrentRoot(value, target, guess, result) : BrentMinimum(value, guess, result);
+        if (outcome == SOAborted) {
+            return failure;
+        }
+        if (outcome == SONotFound) {
+            return Failure(code == OpCode::OpSolve ? ECNoRoot : ECNoMinimum, -1, symbol);
+        }
+    }
+    processed.pop_back();
+    // same as after a call, everything the body reads has been calculated
+    if (function.dirty) {
+        function.dirty = false;
+    }
+    if (profiling) {
+        function.counters.evaluations += evaluations;
+    }
+    return Success;
+}
+
+// runs a sum or integrate. The current call's arguments start at arguments on the stack, the body gets copies of them
+// followed by the loop variable. It's compiled once, every step just sets the variable and runs it again
+CalcStatus Calculator::Loop(OpCode code, const Bytecode& body, size_t arguments, double low, double high, std::vector<double>& stack, std::vector<int>& processed, double& result) {
+    size_t pCount = body.argumentCount - 1;
+    if (!std::isfinite(low) || !std::isfinite(high)) {
+        result = NaN;
+        return Success;
+    }
+    if (code == OpCode::OpSum) {
+        size_t frame = stack.size();
+        for (size_t j{ 0 }; j < pCount; j++) {
+            stack.push_back(stack[arguments + j]);
+        }
+        stack.push_back(low);
+        // compensated, so a long run of small terms doesn't lose them to rounding
+        double sum{ 0 };
+        double compensation{ 0 };
+        // past 2^53 adding 1 does nothing, and the loop would never end
+        for (double k{ low }; k <= high && k + 1 != k; k++) {
+            if (Cancelled()) {
+                return Failure(ECCancelled);
+            }
+            stack[frame + pCount] = k;
+            double term;
+            CalcStatus status = Execute(body, stack, frame, processed, term);
+            if (!status.Ok()) {
+                return status;
+            }
+            double total = sum + term;
+            compensation += std::fabs(sum) >= std::fabs(term) ? (sum - total) + term : (term - total) + sum;
+            sum = total;
+        }
+        stack.resize(frame);
+        result = sum + compensation;
+        return Success;
+    }
+    // every thread integrating gets its own copy of the arguments and variable, and its own stack on top of them
+    auto integrand = [this, &body, pCount](std::vector<double>& values, std::vector<int>& visited, CalcStatus& failure) {
+        return [this, &body, pCount, &values, &visited, &failure](double x, double& y) {
+            if (Cancelled()) {
+                failure = Failure(ECCancelled);
+                return false;
+            }
+            values[pCount] = x;
+            failure = Execute(body, values, 0, visited, y);
+            return failure.Ok();
+        };
+    };
+    std::vector<double> values(stack.begin() + arguments, stack.begin() + arguments + pCount);
+    values.push_back(low);
+    CalcStatus failure = Success;
+    // a first look at the whole range settles the easy integrals. It also leaves everything the body reads calculated,
+    // so the pieces below only read what they share and can run on other threads
+    SolverOutcome outcome = AdaptiveIntegral(integrand(values, processed, failure), low, high, 1, result);
+    if (outcome == SOAborted) {
+        return failure;
+    }
+    if (outcome == SOFound) {
+        return Success;
+    }
+    // the pieces are the same however many threads there are, so the result is too
+    std::vector<double> pieces(IntegralPieces);
+    std::vector<CalcStatus> failures(IntegralPieces, Success);
+    std::vector<SolverOutcome> outcomes(IntegralPieces, SOFound);
+    std::atomic<int> nextPiece{ 0 };
+    auto work = [&] {
+        std::vector<double> copy{ values };
+        std::vector<int> visited{ processed };
+        for (int i{ nextPiece++ }; i < IntegralPieces; i = nextPiece++) {
+            double a = low + (high - low) * i / IntegralPieces;
+            double b = i + 1 == IntegralPieces ? high : low + (high - low) * (i + 1) / IntegralPieces;
+            outcomes[i] = AdaptiveIntegral(integrand(copy, visited, failures[i]), a, b, IntegralIntervals, pieces[i]);
+        }
+    };
+    // a worker waiting on other tasks could be waiting on itself, so inside RecalculateAll it's all done right here
+    if (pool == nullptr) {
+        pool = std::make_unique<ThreadPool>();
+    }
+    size_t helpers = pool->IsWorker() ? 0 : std::min<size_t>(pool->Size(), IntegralPieces - 1);
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t running{ helpers };
+    for (size_t i{ 0 }; i < helpers; i++) {
+        pool->Submit([&] {
+            work();
+            std::lock_guard<std::mutex> lock{ mutex };
+            if (--running == 0) {
+                finished.notify_all();
+            }
+        });
+    }
+    work();
+    {
+        std::unique_lock<std::mutex> lock{ mutex };
+        finished.wait(lock, [&] { return running == 0; });
+    }
+    result = 0;
+    for (int i{ 0 }; i < IntegralPieces; i++) {
+        if (!failures[i].Ok()) {
+            return failures[i];
+        }
+        result += pieces[i];
+    }
+    // a piece that ran out of intervals only has a rough estimate, same as a solve that found nothing
+    for (int i{ 0 }; i < IntegralPieces; i++) {
+        if (outcomes[i] == SONotFound) {
+            return Failure(ECNoIntegral);
+        }
+    }
+    return Success;
+}
+
+struct ClosureContext {
+    Calculator& calculator;
+    std::vector<double>& stack; // call arguments go here, nested variable evaluations push on top
+    size_t frame; // where the arguments of the current call start
+    std::vector<int>& processed;
+};
+
+// thrown when a call no longer matches the callee the tree was built against, Run falls back to the bytecode
+struct StaleClosure {};
+
+// nodes can only return values, so an error inside a tree gets thrown to the Run that started it
+struct ClosureFailure {
+    CalcStatus status;
+};
+
+// how a node reads one of its children. Constants and arguments are read in place, anything else is a call
+struct ReadNode { static double Get(const ClosureNode& child, ClosureContext& context) { return child.eval(child, context); } };
+struct ReadConstant { static double Get(const ClosureNode& child, ClosureContext&) { return child.value; } };
+struct ReadArgument { static double Get(const ClosureNode& child, ClosureContext& context); };
+
+template<int op, class A>
+static double ClosureUnary(const ClosureNode& node, ClosureContext& context) {
+    double d[1] = { A::Get(*node.children[0], context) };
+    return Apply(op, d);
+}
+
+template<int op, class A, class B>
+static double ClosureBinary(const ClosureNode& node, ClosureContext& context) {
+    double d[2];
+    d[0] = A::Get(*node.children[0], context);
+    d[1] = B::Get(*node.children[1], context);
+    return Apply(op, d);
+}
+
+typedef double (*ClosureEval)(const ClosureNode& node, ClosureContext& context);
+
+// picks the instantiation for the kinds of a node's children, 0 for a node, 1 for a constant and 2 for an argument
+typedef ClosureEval (*ClosureSelect)(int a, int b);
+
+template<int op>
+static ClosureEval SelectOperator(int a, int b) {
+    if constexpr (operators[op].argumentCount == 1) {
+        static const ClosureEval table[3] = { ClosureUnary<op, ReadNode>, ClosureUnary<op, ReadConstant>, ClosureUnary<op, ReadArgument> };
+        return table[a];
+    } else {
+        static const ClosureEval table[3][3] = {
+            { ClosureBinary<op, ReadNode, ReadNode>, ClosureBinary<op, ReadNode, ReadConstant>, ClosureBinary<op, ReadNode, ReadArgument> },
+            { ClosureBinary<op, ReadConstant, ReadNode>, ClosureBinary<op, ReadConstant, ReadConstant>, ClosureBinary<op, ReadConstant, ReadArgument> },
+            { ClosureBinary<op, ReadArgument, ReadNode>, ClosureBinary<op, ReadArgument, ReadConstant>, ClosureBinary<op, ReadArgument, ReadArgument> },
+        };
+        return table[a][b];
+    }
+}
+
+template<size_t... I>
+static constexpr std::array<ClosureSelect, BuiltinCount> ClosureSelects(std::index_sequence<I...>) {
+    return { { SelectOperator<I>... } };
+}
+
+// by operator symbol
+static constexpr std::array<ClosureSelect, BuiltinCount> closureOperators = ClosureSelects(std::make_index_sequence<BuiltinCount>{});
+
+static double ClosureConstant(const ClosureNode& node, ClosureContext&) {
+    return node.value;
+}
+
+static double ClosureArgument(const ClosureNode& node, ClosureContext& context) {
+    return context.stack[context.frame + node.operand];
+}
+
+double ReadArgument::Get(const ClosureNode& child, ClosureContext& context) {
+    return context.stack[context.frame + child.operand];
+}
+
+// hands the whole program back to Run, which goes on with the bytecode
+static double ClosureBytecode(const ClosureNode&, ClosureContext&) {
+    throw StaleClosure{};
+}
+
+static int ClosureKind(const ClosureNode* child) {
+    return child->eval == ClosureConstant ? 1 : child->eval == ClosureArgument ? 2 : 0;
+}
+
+double Calculator::ClosureVariable(const ClosureNode& node, ClosureContext& context) {
+    Calculator& calculator = context.calculator;
+    int variable = calculator.variables[node.operand];
+    if (variable == Last) {
+        throw ClosureFailure{ Failure(ECUndefined, -1, node.operand) };
+    }
+    double value;
+    CalcStatus status = calculator.LineValue(variable, context.stack, context.processed, value);
+    if (!status.Ok()) {
+        throw ClosureFailure{ status };
+    }
+    return value;
+}
+
+// same steps as OpCall in Execute
+double Calculator::ClosureCall(const ClosureNode& node, ClosureContext& context) {
+    Calculator& calculator = context.calculator;
+    int definition = calculator.functions[node.operand];
+    if (definition == Last || calculator.inputs[definition]->failed || calculator.inputs[definition]->arguments.size() != (size_t) node.arity) {
+        throw StaleClosure{};
+    }
+    InputLine& function = *calculator.inputs[definition];
+    if (calculator.Cancelled()) {
+        throw ClosureFailure{ Failure(ECCancelled) };
+    }
+    std::vector<double>& stack = context.stack;
+    size_t callFrame = stack.size();
+    for (int j{ 0 }; j < node.arity; j++) {
+        double argument = node.children[j]->eval(*node.children[j], context);
+        stack.push_back(argument);
+    }
+    std::vector<int>& processed = context.processed;
+    if (std::find(processed.begin(), processed.end(), node.operand) != processed.end()) {
+        throw ClosureFailure{ Failure(ECRecursion) };
+    }
+    double result;
+    if (!calculator.CacheLookup(function, stack.data() + callFrame, result)) {
+        processed.push_back(node.operand);
+        CalcStatus status;
+        {
+            ProfileTimer timer{ calculator.profiling ? &function.counters.evaluateTime : nullptr };
+            status = calculator.Run(function.bytecode, function.closure.get(), stack, callFrame, processed, result);
+        }
+        if (!status.Ok()) {
+            throw ClosureFailure{ status };
+        }
+        if (calculator.profiling) {
+            function.counters.evaluations++;
+        }
+        processed.pop_back();
+        if (function.dirty) {
+            function.dirty = false;
+        }
+        calculator.CacheStore(function, stack.data() + callFrame, result);
+    }
+    stack.resize(callFrame);
+    return result;
+}
+
+template<int op, class B>
+static double ClosureStepBinary(double left, const ClosureNode& right, ClosureContext& context) {
+    double d[2];
+    d[0] = left;
+    d[1] = B::Get(right, context);
+    return Apply(op, d);
+}
+
+template<int op>
+static ClosureStep SelectStep(int b) {
+    static const ClosureStep table[3] = { ClosureStepBinary<op, ReadNode>, ClosureStepBinary<op, ReadConstant>, ClosureStepBinary<op, ReadArgument> };
+    return table[b];
+}
+
+template<size_t... I>
+static constexpr std::array<ClosureStep (*)(int), BuiltinCount> ClosureSteps(std::index_sequence<I...>) {
+    return { { (operators[I].argumentCount == 2 ? SelectStep<I> : nullptr)... } };
+}
+
+// by operator symbol, nullptr for the operators that can't be a step of a chain
+static constexpr std::array<ClosureStep (*)(int), BuiltinCount> closureSteps = ClosureSteps(std::make_index_sequence<BuiltinCount>{});
+
+// a left leaning run of binary operators like a + b * c - d / e, evaluated in a loop rather than
+// a call per operator, so long lines don't recurse as deep as they are long
+static double ClosureChain(const ClosureNode& node, ClosureContext& context) {
+    double value = node.children[0]->eval(*node.children[0], context);
+    for (int j{ 0 }; j < node.arity; j++) {
+        value = node.steps[j](value, *node.children[j + 1], context);
+    }
+    return value;
+}
+
+// an instruction and the instructions producing its arguments, the tree before it's turned into nodes
+struct ClosureShape {
+    const Instruction* instruction;
+    std::vector<int> children;
+    int arity;
+};
+
+// variable and call are the evaluators for those nodes, they belong to Calculator
+static const ClosureNode* EmitClosure(const std::vector<ClosureShape>& shapes, int index, const Bytecode& program, ClosureEval variable, ClosureEval call, ClosureTree& tree) {
+    const ClosureShape& shape = shapes[index];
+    const Instruction& instruction = *shape.instruction;
+    ClosureNode node{ nullptr, nullptr, nullptr, 0, instruction.operand, shape.arity };
+    std::vector<const ClosureNode*> children{};
+    if (instruction.code == OpCode::OpOperator && closureSteps[instruction.operand] != nullptr &&
+        shapes[shape.children[0]].instruction->code == OpCode::OpOperator && closureSteps[shapes[shape.children[0]].instruction->operand] != nullptr) {
+        // walk down the left side for as long as it's more of the chain
+        std::vector<int> spine{ index };
+        while (true) {
+            const ClosureShape& left = shapes[shapes[spine.back()].children[0]];
+            if (left.instruction->code != OpCode::OpOperator || closureSteps[left.instruction->operand] == nullptr) {
+                break;
+            }
+            spine.push_back(shapes[spine.back()].children[0]);
+        }
+        children.push_back(EmitClosure(shapes, shapes[spine.back()].children[0], program, variable, call, tree));
+        std::vector<ClosureStep> steps{};
+        for (auto it = spine.rbegin(); it != spine.rend(); ++it) {
+            const ClosureNode* right = EmitClosure(shapes, shapes[*it].children[1], program, variable, call, tree);
+            children.push_back(right);
+            steps.push_back(closureSteps[shapes[*it].instruction->operand](ClosureKind(right)));
+        }
+        node.eval = ClosureChain;
+        node.arity = steps.size();
+        node.steps = tree.steps.data() + tree.steps.size();
+        tree.steps.insert(tree.steps.end(), steps.begin(), steps.end());
+    } else {
+        for (int child : shape.children) {
+            children.push_back(EmitClosure(shapes, child, program, variable, call, tree));
+        }
+        switch (instruction.code) {
+        case OpCode::OpConstant:
+            node.eval = ClosureConstant;
+            node.value = program.constants[instruction.operand];
+            break;
+        case OpCode::OpArgument:
+            node.eval = ClosureArgument;
+            break;
+        case OpCode::OpVariable:
+            node.eval = variable;
+            break;
+        case OpCode::OpOperator: {
+            node.eval = closureOperators[instruction.operand](ClosureKind(children[0]), children.size() == 2 ? ClosureKind(children[1]) : 0);
+            break;
+        }
+        case OpCode::OpCall:
+            node.eval = call;
+            break;
+        case OpCode::OpSolve:
+        case OpCode::OpMinimize:
+        case OpCode::OpSum:
+        case OpCode::OpIntegrate:
+            // BuildClosure leaves programs with these to the bytecode, and so does this node if one ever gets built
+            node.eval = ClosureBytecode;
+            break;
+        }
+    }
+    node.children = tree.children.data() + tree.children.size();
+    tree.children.insert(tree.children.end(), children.begin(), children.end());
+    tree.nodes.push_back(node);
+    return &tree.nodes.back();
+}
+
+// links up nodes for a program. Returns nothing for programs that would fail or whose calls can't be resolved yet,
+// those stay with the bytecode so errors come out exactly as they always have
+std::unique_ptr<ClosureTree> Calculator::BuildClosure(const Bytecode& program) {
+    std::vector<ClosureShape> shapes{};
+    std::vector<int> stack{};
+    for (const Instruction& instruction : program.code) {
+        int count{ 0 };
+        int arity{ 0 };
+        if (instruction.code == OpCode::OpOperator) {
+            count = operators[instruction.operand].argumentCount;
+        } else if (instruction.code == OpCode::OpCall) {
+            int definition = functions[instruction.operand];
+            if (definition == Last || inputs[definition]->failed) {
+                return nullptr;
+            }
+            count = arity = inputs[definition]->arguments.size();
+        } else if (instruction.code != OpCode::OpConstant && instruction.code != OpCode::OpArgument && instruction.code != OpCode::OpVariable) {
+            // solves and loops run from the bytecode, the functions they call still run their own trees
+            return nullptr;
+        }
+        if (stack.size() < (size_t) count) {
+            return nullptr;
+        }
+        shapes.push_back(ClosureShape{ &instruction, std::vector<int>(stack.end() - count, stack.end()), arity });
+        stack.resize(stack.size() - count);
+        stack.push_back(shapes.size() - 1);
+    }
+    if (stack.size() != 1) {
+        return nullptr;
+    }
+    auto tree = std::make_unique<ClosureTree>();
+    // there are never more nodes, children or steps than instructions, so none of these move while pointers into them are taken
+    tree->nodes.reserve(shapes.size());
+    tree->children.reserve(shapes.size());
+    tree->steps.reserve(shapes.size());
+    tree->root = EmitClosure(shapes, stack.back(), program, ClosureVariable, ClosureCall, *tree);
+    return tree;
+}
+
+// runs a line's body with the selected evaluator, frame is where a function's arguments start
+CalcStatus Calculator::Run(const Bytecode& program, const ClosureTree* closure, std::vector<double>& stack, size_t frame, std::vector<int>& processed, double& result) {
+    if (closure != nullptr) {
+        size_t top = stack.size();
+        size_t depth = processed.size();
+        ClosureContext context{ *this, stack, frame, processed };
+        try {
+            result = closure->root->eval(*closure->root, context);
+            return Success;
+        } catch (StaleClosure&) {
+            stack.resize(top);
+            processed.resize(depth);
+        } catch (ClosureFailure& failure) {
+            return failure.status;
+        }
+    }
+    return Execute(program, stack, frame, processed, result);
+}
+
+// rebuilds the trees of lines calling a function that was redefined since. Only done before an evaluation starts,
+// a tree can't be replaced while it might be running
+void Calculator::RefreshClosures() {
+    for (int symbol : staleClosures) {
+        for (InputLine* line : dependents[symbol]) {
+            if (!line->failed) {
+                line->closure = BuildClosure(line->bytecode);
+            }
+        }
+    }
+    staleClosures.clear();
+}
+
+void Calculator::SetEvaluator(EvaluatorKind kind) {
+    evaluator = kind;
+    staleClosures.clear();
+    for (InputLine* line : inputs) {
+        if (line != nullptr) {
+            line->closure = kind == EKClosure && !line->failed ? BuildClosure(line->bytecode) : nullptr;
+        }
+    }
+}
+
+CalcStatus Calculator::Evaluate(const Bytecode& program, double& result) {
+    std::vector<int> processed{};
+    // a previous evaluation might have thrown halfway through
+    valueStack.clear();
+    valueStack.reserve(program.maxStack);
+    // a one off program isn't worth building a tree for, but the lines it reaches still run theirs
+    RefreshClosures();
+    return Execute(program, valueStack, 0, processed, result);
+}
+
+// returns the cached value of a variable or expression line, recalculating it (and whatever it depends on) if it's dirty
+CalcStatus Calculator::LineValue(int handle, std::vector<double>& stack, std::vector<int>& processed, double& value) {
+    InputLine& line = *inputs[handle];
+    if (!line.dirty && line.type != InputLineType::ILFunction) {
+        value = line.value;
+        return Success;
+    }
+    if (Cancelled()) {
+        return Failure(ECCancelled);
+    }
+    if (line.failed) {
+        CalcStatus status = TryParse(line.source, handle);
+        if (!status.Ok()) {
+            return status;
+        }
+    }
+    if (line.type == InputLineType::ILFunction) {
+        return Failure(ECFunctionLine);
+    }
+    if (std::find(processed.begin(), processed.end(), line.symbol) != processed.end()) {
+        return Failure(ECVariableRecursion);
+    }
+    processed.push_back(line.symbol);
+    if (profiling) {
+        line.counters.evaluations++;
+    }
+    ProfileTimer timer{ profiling ? &line.counters.evaluateTime : nullptr };
+    CalcStatus status = Run(line.bytecode, line.closure.get(), stack, stack.size(), processed, value);
+    if (!status.Ok()) {
+        return status;
+    }
+    processed.pop_back();
+    line.value = value;
+    line.dirty = false;
+    return Success;
+}
+
+void Calculator::SetCancelFlag(const std::atomic<bool>* flag) {
+    cancel = flag;
+}
+
+bool Calculator::Cancelled() {
+    return cancel != nullptr && cancel->load(std::memory_order_relaxed);
+}
+
+CalcStatus Calculator::TryEvaluateLine(int index, double& value) {
+    RefreshClosures();
+    std::vector<int> processed{};
+    valueStack.clear();
+    return LineValue(Handle(index), valueStack, processed, value);
+}
+
+double Calculator::EvaluateLine(int index) {
+    double value;
+    CalcStatus status = TryEvaluateLine(index, value);
+    if (!status.Ok()) {
+        Throw(status);
+    }
+    return value;
+}
+
+template<class T>
+CalcStatus Calculator::TryEvaluateLineAs(int index, T& value) {
+    RefreshClosures();
+    std::vector<int> processed{};
+    valueStack.clear();
+    std::vector<T> values{};
+    TypedLines<T> lines{ std::vector<T>(inputs.size()), std::vector<char>(inputs.size(), false), std::vector<std::unique_ptr<Bytecode>>(inputs.size()) };
+    return TypedLineValue(Handle(index), values, valueStack, processed, lines, value);
+}
+
+template<class T>
+T Calculator::EvaluateLineAs(int index) {
+    T value;
+    CalcStatus status = TryEvaluateLineAs(index, value);
+    if (!status.Ok()) {
+        Throw(status);
+    }
+    return value;
+}
+
+template CalcStatus Calculator::TryEvaluateLineAs<double>(int index, double& value);
+template double Calculator::EvaluateLineAs<double>(int index);
+#ifdef CALCULATOR_NUMERIC_TYPES
+template CalcStatus Calculator::TryEvaluateLineAs<float>(int index, float& value);
+template float Calculator::EvaluateLineAs<float>(int index);
+template CalcStatus Calculator::TryEvaluateLineAs<long double>(int index, long double& value);
+template long double Calculator::EvaluateLineAs<long double>(int index);
+template CalcStatus Calculator::TryEvaluateLineAs<Interval>(int index, Interval& value);
+template Interval Calculator::EvaluateLineAs<Interval>(int index);
+#endif
+
+// recalculates every line, running lines on the thread pool as soon as everything they reference is done.
+// results are indexed like the lines
+std::vector<LineResult> Calculator::RecalculateAll() {
+    // references lead to handles, everything here is by position
+    std::vector<int> handles = order.Handles();
+    std::vector<int> positions(inputs.size(), Last);
+    size_t count = handles.size();
+    for (size_t i{ 0 }; i < count; i++) {
+        positions[handles[i]] = i;
+    }
+    std::vector<LineResult> results(count, LineResult{ true, NaN, "" });
+    // parsing changes the shared maps, so failed lines get their retry up front. Keep going while
+    // retries succeed, since a line can define something an earlier one was missing
+    std::vector<CalcStatus> parsed(count, Success);
+    bool progress{ true };
+    while (progress) {
+        progress = false;
+        for (size_t i{ 0 }; i < count; i++) {
+            if (!inputs[handles[i]]->failed) {
+                continue;
+            }
+            parsed[i] = TryParse(inputs[handles[i]]->source, handles[i]);
+            progress |= parsed[i].Ok();
+        }
+    }
+    for (size_t i{ 0 }; i < count; i++) {
+        if (!parsed[i].Ok()) {
+            results[i] = LineResult{ false, NaN, GetErrorMessage(parsed[i]) };
+        }
+    }
+    RefreshClosures();
+    std::vector<std::vector<int>> dependentLines(count);
+    std::vector<std::atomic<int>> remaining(count);
+    std::vector<char> finished(count, false);
+    for (size_t i{ 0 }; i < count; i++) {
+        for (int reference : inputs[handles[i]]->references) {
+            int definition = variables[reference] != Last ? variables[reference] : functions[reference];
+            // undefined references are left for Execute to report
+            if (definition != Last) {
+                dependentLines[positions[definition]].push_back(i);
+                remaining[i]++;
+            }
+        }
+    }
+    if (pool == nullptr) {
+        pool = std::make_unique<ThreadPool>();
+    }
+    std::function<void(int)> run = [&](int i) {
+        InputLine& line = *inputs[handles[i]];
+        LineResult& result = results[i];
+        for (int reference : line.references) {
+            int definition = variables[reference] != Last ? variables[reference] : functions[reference];
+            if (result.ok && definition != Last && !results[positions[definition]].ok) {
+                result = LineResult{ false, NaN, results[positions[definition]].error };
+            }
+        }
+        if (result.ok && line.type == InputLineType::ILFunction) {
+            // nothing calls the function until it's done here, so the cache can be emptied without the lock
+            if (line.dirty && line.cache != nullptr) {
+                ResetCache(line, cacheSize);
+            }
+            line.dirty = false;
+        } else if (result.ok) {
+            if (line.dirty) {
+                // everything this line references is clean by now, so nothing below touches shared state
+                static thread_local std::vector<double> stack{};
+                std::vector<int> processed{ line.symbol };
+                stack.clear();
+                if (profiling) {
+                    line.counters.evaluations++;
+                }
+                ProfileTimer timer{ profiling ? &line.counters.evaluateTime : nullptr };
+                CalcStatus status = Run(line.bytecode, line.closure.get(), stack, 0, processed, line.value);
+                if (status.Ok()) {
+                    line.dirty = false;
+                } else {
+                    result = LineResult{ false, NaN, GetErrorMessage(status) };
+                }
+            }
+            result.value = line.value;
+        }
+        finished[i] = true;
+        for (int dependent : dependentLines[i]) {
+            if (remaining[dependent].fetch_sub(1) == 1) {
+                pool->Submit([&run, dependent] { run(dependent); });
+            }
+        }
+    };
+    std::vector<int> ready{};
+    for (size_t i{ 0 }; i < count; i++) {
+        if (remaining[i] == 0) {
+            ready.push_back(i);
+        }
+    }
+    for (int i : ready) {
+        pool->Submit([&run, i] { run(i); });
+    }
+    pool->Wait();
+    // whatever never became ready is part of a cycle or reads one. Evaluating those one at a time like
+    // TryEvaluateLine does tells calling a recursive function apart from variables that read each other
+    for (size_t i{ 0 }; i < count; i++) {
+        if (finished[i]) {
+            continue;
+        }
+        if (inputs[handles[i]]->type == InputLineType::ILFunction) {
+            results[i] = LineResult{ false, NaN, "Recursion detected" };
+            continue;
+        }
+        std::vector<int> processed{};
+        valueStack.clear();
+        double value;
+        CalcStatus status = LineValue(handles[i], valueStack, processed, value);
+        results[i] = status.Ok() ? LineResult{ true, value, "" } : LineResult{ false, NaN, GetErrorMessage(status) };
+    }
+    return results;
+}
+
+CalcStatus Calculator::TryEvaluatePostfix(const std::deque<PostfixItem>& items, double& value) {
+    Bytecode program{};
+    CalcStatus status = TryCompile(items, {}, foldConstants, program);
+    if (!status.Ok()) {
+        return status;
+    }
+    return Evaluate(program, value);
+}
+
+double Calculator::EvaluatePostfix(const std::deque<PostfixItem>& items) {
+    double value;
+    CalcStatus status = TryEvaluatePostfix(items, value);
+    if (!status.Ok()) {
+        Throw(status);
+    }
+    return value;
+}
+
+static const size_t BatchWidth = 256;
+
+struct BatchState {
+    std::vector<int> columnOf; // by symbol, Last if the symbol isn't bound
+    const std::vector<std::vector<double>>& columns;
+    std::vector<char> dependsOnBatch; // by symbol, 0 unknown, 1 no, 2 yes
+    size_t start; // first row of the current block
+    size_t count; // rows in the current block
+};
+
+// whether symbol reads one of the bound variables, directly or through other lines
+bool Calculator::DependsOnBatch(int symbol, BatchState& state) {
+    // a re-parse below can intern new symbols
+    if ((size_t) symbol >= state.dependsOnBatch.size()) {
+        state.dependsOnBatch.resize(symbols.Size(), 0);
+        state.columnOf.resize(symbols.Size(), Last);
+    }
+    if (state.dependsOnBatch[symbol] != 0) {
+        return state.dependsOnBatch[symbol] == 2;
+    }
+    if (state.columnOf[symbol] != Last) {
+        state.dependsOnBatch[symbol] = 2;
+        return true;
+    }
+    state.dependsOnBatch[symbol] = 1; // also stops cycles, evaluation reports those
+    int handle = variables[symbol] != Last ? variables[symbol] : functions[symbol];
+    if (handle == Last) {
+        return false;
+    }
+    // a line that still doesn't parse reports that once it's evaluated
+    if (inputs[handle]->failed && !TryParse(inputs[handle]->source, handle).Ok()) {
+        return false;
+    }
+    for (int reference : inputs[handle]->references) {
+        if (DependsOnBatch(reference, state)) {
+            state.dependsOnBatch[symbol] = 2;
+            return true;
+        }
+    }
+    return false;
+}
+
+// whether a loop body reads one of the bound variables, through anything it reads or calls
+bool Calculator::DependsOnBatch(const Bytecode& program, BatchState& state) {
+    for (const Instruction& instruction : program.code) {
+        switch (instruction.code) {
+        case OpCode::OpVariable:
+        case OpCode::OpCall:
+        case OpCode::OpSolve:
+        case OpCode::OpMinimize:
+            if (DependsOnBatch(instruction.operand, state)) {
+                return true;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    for (const Bytecode& body : program.bodies) {
+        if (DependsOnBatch(body, state)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// same as Execute, but pushes and pops whole blocks of batchStack, frame is the block index of the first argument
+CalcStatus Calculator::ExecuteBatch(const Bytecode& program, size_t frame, std::vector<int>& processed, BatchState& state) {
+    size_t base = batchStack.size() / BatchWidth;
+    for (const Instruction& instruction : program.code) {
+        size_t top = batchStack.size();
+        switch (instruction.code) {
+        case OpCode::OpConstant:
+            batchStack.resize(top + BatchWidth, program.constants[instruction.operand]);
+            break;
+        case OpCode::OpArgument:
+            batchStack.resize(top + BatchWidth);
+            std::copy_n(batchStack.begin() + (frame + instruction.operand) * BatchWidth, state.count, batchStack.begin() + top);
+            break;
+        case OpCode::OpVariable: {
+            int symbol = instruction.operand;
+            if ((size_t) symbol < state.columnOf.size() && state.columnOf[symbol] != Last) {
+                const std::vector<double>& column = state.columns[state.columnOf[symbol]];
+                batchStack.resize(top + BatchWidth);
+                std::copy_n(column.begin() + state.start, state.count, batchStack.begin() + top);
+                break;
+            }
+            if (variables[symbol] == Last) {
+                return Failure(ECUndefined, -1, symbol);
+            }
+            if (!DependsOnBatch(symbol, state)) {
+                double value;
+                CalcStatus status = LineValue(variables[symbol], valueStack, processed, value);
+                if (!status.Ok()) {
+                    return status;
+                }
+                batchStack.resize(top + BatchWidth, value);
+                break;
+            }
+            if (std::find(processed.begin(), processed.end(), symbol) != processed.end()) {
+                return Failure(ECVariableRecursion);
+            }
+            processed.push_back(symbol);
+            CalcStatus status = ExecuteBatch(inputs[variables[symbol]]->bytecode, top / BatchWidth, processed, state);
+            if (!status.Ok()) {
+                return status;
+            }
+            processed.pop_back();
+            break;
+        }
+        case OpCode::OpOperator: {
+            size_t argumentCount = operators[instruction.operand].argumentCount;
+            if (top / BatchWidth - base < argumentCount) {
+                return Failure(ECWrongArgumentCount);
+            }
+            double* arguments[8];
+            for (size_t j{ 0 }; j < argumentCount; ++j) {
+                arguments[j] = batchStack.data() + top - (argumentCount - j) * BatchWidth;
+            }
+            batchKernelList[instruction.operand](arguments, state.count);
+            batchStack.resize(top - (argumentCount - 1) * BatchWidth);
+            break;
+        }
+        case OpCode::OpCall: {
+            int definition = functions[instruction.operand];
+            if (definition == Last) {
+                return Failure(ECUndefined, -1, instruction.operand);
+            }
+            if (inputs[definition]->failed) {
+                CalcStatus status = TryParse(inputs[definition]->source, definition);
+                if (!status.Ok()) {
+                    return status;
+                }
+            }
+            InputLine& function = *inputs[definition];
+            size_t pCount = function.arguments.size();
+            if (top / BatchWidth - base < pCount) {
+                return Failure(ECMissingArguments);
+            }
+            if (std::find(processed.begin(), processed.end(), instruction.operand) != processed.end()) {
+                return Failure(ECRecursion);
+            }
+            size_t callFrame = top / BatchWidth - pCount;
+            processed.push_back(instruction.operand);
+            CalcStatus status = ExecuteBatch(function.bytecode, callFrame, processed, state);
+            if (!status.Ok()) {
+                return status;
+            }
+            processed.pop_back();
+            // move the result down over the arguments
+            std::copy_n(batchStack.end() - BatchWidth, state.count, batchStack.begin() + callFrame * BatchWidth);
+            batchStack.resize((callFrame + 1) * BatchWidth);
+            break;
+        }
+        case OpCode::OpSolve:
+        case OpCode::OpMinimize: {
+            size_t argumentCount = instruction.code == OpCode::OpSolve ? 2 : 1;
+            if (top / BatchWidth - base < argumentCount) {
+                return Failure(ECWrongArgumentCount);
+            }
+            // every row is solved on its own, with the function reading the variables it always does
+            if (DependsOnBatch(instruction.operand, state)) {
+                return Failure(ECBoundSolve, -1, instruction.operand);
+            }
+            double* targets = batchStack.data() + top - argumentCount * BatchWidth;
+            const double* guesses = batchStack.data() + top - BatchWidth;
+            for (size_t i{ 0 }; i < state.count; i++) {
+                double value;
+                CalcStatus status = Solve(instruction.code, instruction.operand, targets[i], guesses[i], valueStack, processed, value);
+                if (!status.Ok()) {
+                    return status;
+                }
+                targets[i] = value;
+            }
+            batchStack.resize(top - (argumentCount - 1) * BatchWidth);
+            break;
+        }
+        case OpCode::OpSum:
+        case OpCode::OpIntegrate: {
+            if (top / BatchWidth - base < 2) {
+                return Failure(ECWrongArgumentCount);
+            }
+            // same as solving, every row loops on its own with its own arguments
+            const Bytecode& body = program.bodies[instruction.operand];
+            if (DependsOnBatch(body, state)) {
+                return Failure(ECBoundLoop);
+            }
+            size_t pCount = body.argumentCount - 1;
+            double* lows = batchStack.data() + top - 2 * BatchWidth;
+            const double* highs = batchStack.data() + top - BatchWidth;
+            for (size_t i{ 0 }; i < state.count; i++) {
+                size_t arguments = valueStack.size();
+                for (size_t j{ 0 }; j < pCount; j++) {
+                    valueStack.push_back(batchStack[(frame + j) * BatchWidth + i]);
+                }
+                double value;
+                CalcStatus status = Loop(instruction.code, body, arguments, lows[i], highs[i], valueStack, processed, value);
+                valueStack.resize(arguments);
+                if (!status.Ok()) {
+                    return status;
+                }
+                lows[i] = value;
+            }
+            batchStack.resize(top - BatchWidth);
+            break;
+        }
+        }
+    }
+    if (batchStack.size() / BatchWidth != base + 1) {
+        return Failure(ECWrongArgumentCount);
+    }
+    return Success;
+}
+
+// evaluates a variable or expression line once per row of columns, with each of names bound to its column's value.
+// names override the user variables of the same name, anything not bound keeps its usual value
+std::vector<double> Calculator::EvaluateBatch(int index, const std::vector<std::string>& names, const std::vector<std::vector<double>>& columns) {
+    std::vector<double> results{};
+    CalcStatus status = TryEvaluateBatch(index, names, columns, results);
+    if (!status.Ok()) {
+        Throw(status);
+    }
+    return results;
+}
+
+CalcStatus Calculator::TryEvaluateBatch(int index, const std::vector<std::string>& names, const std::vector<std::vector<double>>& columns, std::vector<double>& results) {
+    results.clear();
+    if (names.size() != columns.size()) {
+        return Failure(ECColumnCount);
+    }
+    size_t rows = columns.empty() ? 1 : columns[0].size();
+    for (const std::vector<double>& column : columns) {
+        if (column.size() != rows) {
+            return Failure(ECColumnLength);
+        }
+    }
+    int handle = Handle(index);
+    if (inputs[handle]->failed) {
+        CalcStatus status = TryParse(inputs[handle]->source, handle);
+        if (!status.Ok()) {
+            return status;
+        }
+    }
+    InputLine& line = *inputs[handle];
+    if (line.type == InputLineType::ILFunction) {
+        return Failure(ECFunctionLine);
+    }
+    BatchState state{ std::vector<int>(symbols.Size(), Last), columns, std::vector<char>(symbols.Size(), 0), 0, 0 };
+    for (size_t i{ 0 }; i < names.size(); i++) {
+        // a name nothing has ever mentioned can't be read by the line either
+        int symbol = symbols.Find(names[i]);
+        if (symbol != SymbolTable::None) {
+            state.columnOf[symbol] = i;
+        }
+    }
+    results.resize(rows);
+    for (size_t start{ 0 }; start < rows; start += BatchWidth) {
+        std::vector<int> processed{};
+        state.start = start;
+        state.count = std::min(BatchWidth, rows - start);
+        valueStack.clear();
+        batchStack.clear();
+        CalcStatus status = ExecuteBatch(line.bytecode, 0, processed, state);
+        if (!status.Ok()) {
+            results.clear();
+            return status;
+        }
+        std::copy_n(batchStack.begin(), state.count, results.begin() + start);
+    }
+    return Success;
+}
+
+// snapshot layout, everything in the machine's own byte order:
+//   SnapshotHeader
+//   symbolCount names, each a uint32_t length and the bytes
+//   lineCount lines, each a SnapshotLine followed by its identifier, source, argument symbols, postfix, code,
+//   constants and references
+// the arrays are stored exactly as they sit in memory, so loading them is a straight copy
+static const char SnapshotMagic[4] = { 'U', 'C', 'S', 'N' };
+static const uint32_t SnapshotVersion = 2;
+static const uint32_t SnapshotFolded = 1; // the bytecode was compiled with constant folding
+
+struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t symbolCount;
+    uint32_t lineCount;
+    uint32_t unused;
+    uint64_t size; // of the whole file, catches truncated writes
+};
+
+struct SnapshotLine {
+    uint8_t type;
+    uint8_t failed;
+    uint8_t dirty;
+    uint8_t recompile; // the bytecode has loop bodies, which aren't stored, so it's compiled again from the postfix
+    int32_t symbol;
+    double value;
+    uint32_t argumentCount;
+    uint32_t postfixCount;
+    uint32_t codeCount;
+    uint32_t constantCount;
+    uint32_t referenceCount;
+    uint32_t unused2;
+    uint64_t maxStack;
+};
+
+static_assert(std::is_trivially_copyable<PostfixItem>::value && std::is_trivially_copyable<Instruction>::value, "snapshot arrays are copied as bytes");
+
+template<typename T>
+static void SnapshotWrite(std::string& out, const T* data, size_t count) {
+    out.append(reinterpret_cast<const char*>(data), sizeof(T) * count);
+}
+
+static void SnapshotWriteString(std::string& out, const std::string& str) {
+    uint32_t length = str.size();
+    SnapshotWrite(out, &length, 1);
+    out += str;
+}
+
+// walks a loaded snapshot, failing instead of reading past the end
+struct SnapshotReader {
+    const char* at;
+    const char* end;
+
+    const char* Read(size_t bytes) {
+        if ((size_t) (end - at) < bytes) {
+            plError("Snapshot is truncated");
+        }
+        const char* data = at;
+        at += bytes;
+        return data;
+    }
+
+    template<typename T>
+    T Value() {
+        T value;
+        std::memcpy(&value, Read(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    template<typename T, typename Container>
+    void Array(Container& out, size_t count) {
+        // a byte buffer gives no alignment guarantees, so arrays get copied out rather than pointed at
+        const char* data = Read(sizeof(T) * count);
+        out.resize(count);
+        if (count != 0) {
+            std::memcpy(&out[0], data, sizeof(T) * count);
+        }
+    }
+
+    std::string_view String() {
+        uint32_t length = Value<uint32_t>();
+        return std::string_view(Read(length), length);
+    }
+};
+
+bool Calculator::SaveSnapshot(const std::string& path, const std::vector<std::string>& sources) {
+    if (sources.size() != (size_t) LineCount()) {
+        plError("Need the source of every line for a snapshot");
+    }
+    std::string out{};
+    SnapshotHeader header{};
+    std::memcpy(header.magic, SnapshotMagic, sizeof(header.magic));
+    header.version = SnapshotVersion;
+    header.flags = foldConstants ? SnapshotFolded : 0;
+    header.symbolCount = symbols.Size();
+    header.lineCount = LineCount();
+    SnapshotWrite(out, &header, 1);
+    for (size_t i{ 0 }; i < symbols.Size(); i++) {
+        SnapshotWriteString(out, symbols.Name(i));
+    }
+    std::vector<int> handles = order.Handles();
+    for (size_t i{ 0 }; i < handles.size(); i++) {
+        const InputLine& line = *inputs[handles[i]];
+        SnapshotLine record{};
+        record.type = line.type;
+        record.failed = line.failed;
+        record.dirty = line.dirty;
+        record.recompile = !line.bytecode.bodies.empty();
+        record.symbol = line.symbol;
+        record.value = line.value;
+        record.argumentCount = line.argumentSymbols.size();
+        record.postfixCount = line.postfix.size();
+        record.codeCount = line.bytecode.code.size();
+        record.constantCount = line.bytecode.constants.size();
+        record.referenceCount = line.references.size();
+        record.maxStack = line.bytecode.maxStack;
+        SnapshotWrite(out, &record, 1);
+        SnapshotWriteString(out, line.identifier);
+        SnapshotWriteString(out, sources[i]);
+        SnapshotWrite(out, line.argumentSymbols.data(), line.argumentSymbols.size());
+        // the only one that isn't contiguous
+        for (const PostfixItem& item : line.postfix) {
+            SnapshotWrite(out, &item, 1);
+        }
+        SnapshotWrite(out, line.bytecode.code.data(), line.bytecode.code.size());
+        SnapshotWrite(out, line.bytecode.constants.data(), line.bytecode.constants.size());
+        SnapshotWrite(out, line.references.data(), line.references.size());
+    }
+    header.size = out.size();
+    std::memcpy(&out[0], &header, sizeof(header));
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(out.data(), out.size());
+    return (bool) file;
+}
+
+bool Calculator::LoadSnapshot(const std::string& path, const std::vector<std::string>& sources) {
+    if (LineCount() != 0) {
+        return false;
+    }
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+    std::vector<char> buffer(file.tellg());
+    file.seekg(0);
+    if (!file.read(buffer.data(), buffer.size())) {
+        return false;
+    }
+    SnapshotReader reader{ buffer.data(), buffer.data() + buffer.size() };
+    SnapshotHeader header{};
+    std::vector<std::string_view> names{};
+    const char* firstLine{ nullptr };
+    bool folded{ false };
+    // the first pass only checks, so a snapshot that can't be used leaves the calculator untouched
+    try {
+        header = reader.Value<SnapshotHeader>();
+        if (std::memcmp(header.magic, SnapshotMagic, sizeof(header.magic)) != 0 || header.version != SnapshotVersion ||
+            header.size != buffer.size() || header.lineCount != sources.size()) {
+            return false;
+        }
+        // every name takes at least its length, so a count the file can't hold is caught before allocating for it
+        if (header.symbolCount > buffer.size() / sizeof(uint32_t)) {
+            return false;
+        }
+        // ids in the snapshot only mean something if this table hands out the same ones. The built-ins always come
+        // first, so a snapshot from a build with different built-ins is caught here too
+        folded = (header.flags & SnapshotFolded) != 0;
+        names.resize(header.symbolCount);
+        for (std::string_view& name : names) {
+            name = reader.String();
+        }
+        for (size_t i{ 0 }; i < std::min<size_t>(names.size(), symbols.Size()); i++) {
+            if (names[i] != symbols.Name(i)) {
+                return false;
+            }
+        }
+        // a name that's already taken would be handed its old id, and every id after it would be off by one
+        std::unordered_set<std::string_view> added{};
+        for (size_t i{ symbols.Size() }; i < names.size(); i++) {
+            if (symbols.Find(std::string(names[i])) != SymbolTable::None || !added.insert(names[i]).second) {
+                return false;
+            }
+        }
+        firstLine = reader.at;
+        for (size_t i{ 0 }; i < header.lineCount; i++) {
+            SnapshotLine record = reader.Value<SnapshotLine>();
+            reader.String();
+            // the text the line was parsed from has to be the text it has now
+            if (reader.String() != sources[i]) {
+                return false;
+            }
+            // every id is used to index something once the line is loaded, so none can be let through unchecked
+            auto isSymbol = [&](int symbol) { return symbol >= 0 && (size_t) symbol < names.size(); };
+            if (record.type > InputLineType::Expression || (record.type != InputLineType::Expression && !isSymbol(record.symbol))) {
+                return false;
+            }
+            std::vector<int> argumentSymbols{};
+            for (size_t j{ 0 }; j < record.argumentCount; j++) {
+                argumentSymbols.push_back(reader.Value<int>());
+                if (!isSymbol(argumentSymbols.back())) {
+                    return false;
+                }
+            }
+            std::deque<PostfixItem> postfix{};
+            for (size_t j{ 0 }; j < record.postfixCount; j++) {
+                // an enum holding a value it doesn't name is undefined, so the type is checked as a plain number first
+                const char* data = reader.Read(sizeof(PostfixItem));
+                std::underlying_type_t<ItemType> type;
+                int symbol;
+                std::memcpy(&type, data + offsetof(PostfixItem, type), sizeof(type));
+                std::memcpy(&symbol, data + offsetof(PostfixItem, symbol), sizeof(symbol));
+                switch (type) {
+                case ItemType::Operand:
+                case ItemType::OperandSymbol:
+                    break;
+                case ItemType::Function:
+                    if (symbol < 0 || symbol >= BuiltinCount) {
+                        return false;
+                    }
+                    break;
+                case ItemType::Variable:
+                case ItemType::UserFunction:
+                case ItemType::FunctionReference:
+                case ItemType::LoopBody:
+                case ItemType::LoopVariable:
+                    if (!isSymbol(symbol)) {
+                        return false;
+                    }
+                    break;
+                default:
+                    return false;
+                }
+                postfix.push_back(PostfixItem{});
+                std::memcpy(&postfix.back(), data, sizeof(PostfixItem));
+            }
+            // what gets compiled again has to compile, the calculator can't be left with half a snapshot
+            Bytecode compiled{};
+            if (!record.failed && (folded != foldConstants || record.recompile) && !TryCompile(postfix, argumentSymbols, foldConstants, compiled).Ok()) {
+                return false;
+            }
+            for (size_t j{ 0 }; j < record.codeCount; j++) {
+                Instruction instruction = reader.Value<Instruction>();
+                switch (instruction.code) {
+                case OpCode::OpConstant:
+                    if (instruction.operand < 0 || (size_t) instruction.operand >= record.constantCount) {
+                        return false;
+                    }
+                    break;
+                case OpCode::OpArgument:
+                    if (instruction.operand < 0 || (size_t) instruction.operand >= record.argumentCount) {
+                        return false;
+                    }
+                    break;
+                case OpCode::OpOperator:
+                    if (instruction.operand < 0 || instruction.operand >= BuiltinCount) {
+                        return false;
+                    }
+                    break;
+                case OpCode::OpVariable:
+                case OpCode::OpCall:
+                case OpCode::OpSolve:
+                case OpCode::OpMinimize:
+                    if (!isSymbol(instruction.operand)) {
+                        return false;
+                    }
+                    break;
+                case OpCode::OpSum:
+                case OpCode::OpIntegrate:
+                    // the bodies aren't stored, a line that has them gets compiled again
+                    if (!record.recompile) {
+                        return false;
+                    }
+                    break;
+                default:
+                    return false;
+                }
+            }
+            reader.Read(sizeof(double) * record.constantCount);
+            for (size_t j{ 0 }; j < record.referenceCount; j++) {
+                if (!isSymbol(reader.Value<int>())) {
+                    return false;
+                }
+            }
+        }
+        if (reader.at != reader.end) {
+            return false;
+        }
+    } catch (std::exception&) {
+        return false;
+    }
+    for (size_t i{ symbols.Size() }; i < names.size(); i++) {
+        Intern(std::string(names[i]));
+    }
+    reader.at = firstLine;
+    std::vector<int> references{};
+    for (size_t i{ 0 }; i < header.lineCount; i++) {
+        int handle = AddLine(i);
+        InputLine& line = *inputs[handle];
+        SnapshotLine record = reader.Value<SnapshotLine>();
+        line.type = (InputLineType) record.type;
+        line.identifier = reader.String();
+        reader.String();
+        line.symbol = record.symbol;
+        line.failed = record.failed;
+        line.dirty = record.dirty;
+        line.value = record.value;
+        reader.Array<int>(line.argumentSymbols, record.argumentCount);
+        for (int symbol : line.argumentSymbols) {
+            line.arguments.push_back(symbols.Name(symbol));
+        }
+        for (size_t j{ 0 }; j < record.postfixCount; j++) {
+            line.postfix.push_back(reader.Value<PostfixItem>());
+        }
+        reader.Array<Instruction>(line.bytecode.code, record.codeCount);
+        reader.Array<double>(line.bytecode.constants, record.constantCount);
+        line.bytecode.maxStack = record.maxStack;
+        line.bytecode.argumentCount = record.argumentCount;
+        reader.Array<int>(references, record.referenceCount);
+        // the text stays with the line, same as after ParseLine
+        line.source = sources[i];
+        Define(line, handle);
+        SetReferences(&line, references);
+        if (line.type == InputLineType::ILFunction) {
+            line.cache = std::make_unique<CallCache>();
+        }
+        if (!line.failed && (folded != foldConstants || record.recompile)) {
+            Compile(line.postfix, line.argumentSymbols, line.bytecode);
+        }
+        if (evaluator == EKClosure && !line.failed) {
+            line.closure = BuildClosure(line.bytecode);
+        }
+    }
+    return true;
+}
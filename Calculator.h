@@ -3,8 +3,20 @@
 #include <vector>
 #include <deque>
 #include <string>
-#include <map>
+#include <string_view>
 #include <set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+
+#include "Arena.h"
+#include "SymbolTable.h"
+#include "SymbolTrie.h"
+#include "ThreadPool.h"
+#include "Interval.h"
+#include "LineOrder.h"
 
 enum ItemType {
     Operand,
@@ -12,6 +24,9 @@ enum ItemType {
     Variable,
     Function,
     UserFunction,
+    FunctionReference, // a user function named without being called, the first argument of solve and minimize
+    LoopBody, // where the body of a sum or integrate starts, symbol is the variable it binds
+    LoopVariable, // the variable a sum or integrate binds, right after the body it's bound in
     Other
 };
 
@@ -23,45 +38,344 @@ enum InputLineType {
 
 struct PostfixItem {
     ItemType type;
-    std::string name;
+    int symbol; // interned name of operators, variables and user functions
     double value;
 };
 
+enum OpCode : unsigned char {
+    OpConstant, // push constants[operand]
+    OpVariable, // push the value of the user variable with symbol operand
+    OpArgument, // push argument slot operand of the current function call
+    OpOperator, // apply the built-in operator with symbol operand
+    OpCall,     // call the user function with symbol operand
+    OpSolve,    // solve the user function with symbol operand for the target and guess on the stack
+    OpMinimize, // minimize the user function with symbol operand, starting at the guess on the stack
+    OpSum,      // sum bodies[operand] over the bounds on the stack
+    OpIntegrate // integrate bodies[operand] between the bounds on the stack
+};
+
+struct Instruction {
+    OpCode code;
+    int operand;
+};
+
+// flat form of a postfix expression, evaluated in one pass over a value stack
+struct Bytecode {
+    std::vector<Instruction> code;
+    std::vector<double> constants;
+    size_t maxStack;
+    size_t argumentCount; // of the function, for a loop body including the loop variables
+    std::vector<Bytecode> bodies; // of the sums and integrals, each run with the program's arguments plus its variable
+};
+
+struct ClosureContext;
+struct ClosureNode;
+
+// applies one operator of a chain to the value so far and the operator's right hand side
+typedef double (*ClosureStep)(double left, const ClosureNode& right, ClosureContext& context);
+
+// one operation of a closure tree, eval is picked for the node's exact kind when the tree is built
+struct ClosureNode {
+    double (*eval)(const ClosureNode& node, ClosureContext& context);
+    const ClosureNode* const* children;
+    const ClosureStep* steps; // chains only
+    double value; // constants
+    int operand; // argument slot, operator, or symbol of a variable or function
+    int arity; // for calls the callee's argument count when the tree was built, for chains the number of steps
+};
+
+// a line's bytecode turned into directly linked nodes, evaluating it is one call per node
+struct ClosureTree {
+    std::vector<ClosureNode> nodes;
+    std::vector<const ClosureNode*> children;
+    std::vector<ClosureStep> steps;
+    const ClosureNode* root;
+};
+
+enum EvaluatorKind {
+    EKBytecode,
+    EKClosure
+};
+
+// results of recent calls of a user function, keyed by the exact bits of the arguments. Direct mapped, a new
+// result just replaces whatever shared its slot. Emptied whenever the function is dirty, which covers redefining
+// it and changing anything it reads
+struct CallCache {
+    std::mutex lock; // RecalculateAll can call the same function from several threads
+    std::vector<double> keys; // the arguments of every slot, one after another
+    std::vector<double> results;
+    std::vector<char> used;
+    size_t hits;
+    size_t misses;
+};
+
+struct CacheStats {
+    size_t hits;
+    size_t misses;
+    size_t entries;
+};
+
+// running totals for one line, only counted while profiling is on. Function lines are timed per call, other lines
+// per evaluation, and both include whatever they had to evaluate first. Atomic since RecalculateAll can call the
+// same function from several threads
+struct LineCounters {
+    std::atomic<uint64_t> parseTime; // nanoseconds
+    std::atomic<uint64_t> parses;
+    std::atomic<uint64_t> reparses; // lazy retries of text that failed to parse before
+    std::atomic<uint64_t> expandTime;
+    std::atomic<uint64_t> expandedTokens; // size of the last expansion
+    std::atomic<uint64_t> evaluateTime;
+    std::atomic<uint64_t> evaluations;
+};
+
+// a copy of a line's counters, plus its call cache's
+struct LineProfile {
+    uint64_t parseTime;
+    uint64_t parses;
+    uint64_t reparses;
+    uint64_t expandTime;
+    uint64_t expandedTokens;
+    uint64_t evaluateTime;
+    uint64_t evaluations;
+    size_t cacheHits;
+    size_t cacheMisses;
+};
+
+struct LineTokens;
+
 struct InputLine {
     InputLineType type;
     std::string identifier;
+    int symbol; // interned identifier
     std::vector<std::string> arguments;
+    std::vector<int> argumentSymbols;
     std::deque<PostfixItem> postfix;
-    std::string source;
+    Bytecode bytecode;
+    std::string source; // the text as last parsed, edits apply to it
     bool failed;
+    std::vector<int> references; // sorted symbols of the user variables and functions the right hand side uses
+    double value; // cached result, only meaningful while the line isn't dirty
+    bool dirty;
+    std::unique_ptr<CallCache> cache; // function lines only
+    std::unique_ptr<ClosureTree> closure; // only with the closure evaluator, and only if the line compiled cleanly
+    std::unique_ptr<LineTokens> tokens; // kept from one parse to the next once the line gets edited, see EditLine
+    LineCounters counters;
 };
 
+struct LineResult {
+    bool ok;
+    double value; // NaN for function lines
+    std::string error;
+};
+
+enum ErrorCode {
+    ECNone,
+    ECExpectedName,
+    ECEmptyArgument,
+    ECExpectedArgument,
+    ECEmptyIdentifier,
+    ECDefinedTwice,
+    ECTwoDecimalPoints,
+    ECUnknownIdentifier,
+    ECMismatchedParentheses,
+    ECInvalidSymbol,
+    ECUndefined,
+    ECMissingArguments,
+    ECRecursion,
+    ECVariableRecursion,
+    ECWrongArgumentCount,
+    ECCancelled,
+    ECExpectedFunction,
+    ECSolveArguments,
+    ECNoRoot,
+    ECNoMinimum,
+    ECNotDifferentiable, // only ever seen by the solver, which falls back to a method without derivatives
+    ECExpectedLoopVariable,
+    ECFunctionLine, // a function's body only has arguments when it's called
+    ECNoIntegral,
+    ECBoundSolve, // batches solve every row on its own, the function can't read a column
+    ECBoundLoop,
+    ECColumnCount,
+    ECColumnLength,
+    ECInexactBounds // sum bounds in a number type that only knows them as a range
+};
+
+// how a parse or evaluation went. Small enough to pass around by value, so failing costs next to nothing, and the
+// message is only put together when someone asks for it with GetErrorMessage
+struct CalcStatus {
+    ErrorCode code;
+    int position; // index into the line's right hand side, or -1
+    int symbol; // the name the error is about, or SymbolTable::None
+
+    bool Ok() const {
+        return code == ECNone;
+    }
+};
+
+// thrown out of an evaluation when the calculator's cancel flag gets set, nothing it did so far is kept
+struct EvaluationCancelled : std::runtime_error {
+    EvaluationCancelled() : std::runtime_error{ "Evaluation cancelled" } {
+    }
+};
+
+struct BatchState;
+template<class T>
+struct TypedLines;
 
 class Calculator {
 private:
     static const char Assignment = '=';
     static const int Last = -1;
 
-    std::map<std::string, int> variables; // user variables with their associated input
-    std::map<std::string, int> functions; // user functions with their associated input
-    std::vector<InputLine*> inputs;
-    int evaluateLine = Last;
+    SymbolTable symbols;
+    // everything below that's indexed by symbol grows with the table in Intern
+    std::vector<int> variables; // the handle of the line defining each symbol as a user variable, or Last
+    std::vector<int> functions; // the handle of the line defining each symbol as a user function, or Last
+    std::vector<InputLine*> inputs; // by handle, nullptr once a line is removed
+    LineOrder order; // where each handle's line is in the sheet
+    // the InputLine objects themselves, released all at once with the calculator. What they hold, the strings,
+    // vectors, postfix and bytecode, is still on the heap: a line keeps its capacity from one parse to the next,
+    // but a line that grows or gets removed allocates and frees like any other container
+    Arena lineArena;
+    std::vector<InputLine*> freeLines; // removed lines, ready to be reused
+    Arena parseArena; // scratch space for finishing a parse, reset every time
+    std::vector<std::set<InputLine*>> dependents; // lines that reference each symbol, defined or not
+    SymbolTrie symbolTrie; // built-ins plus the current user variables and functions, used for tokenizing
+    std::vector<double> valueStack; // reused by every evaluation, nested evaluations push on top of it
+    std::vector<double> batchStack; // same idea for batch evaluation, but every slot is a block of lanes
+    std::unique_ptr<ThreadPool> pool; // created the first time RecalculateAll needs it
+    int evaluateLine = Last; // a handle
+    size_t cacheSize = 256; // slots in each function's call cache, 0 turns caching off
+    bool foldConstants = true; // whether Compile folds constant parts of expressions
+    EvaluatorKind evaluator = EKBytecode;
+    std::vector<int> staleClosures; // functions redefined since the trees calling them were built
+    bool profiling = false; // whether lines fill in their counters, checked before touching the clock
+    uint64_t trieGeneration = 0; // goes up whenever a user variable or function comes or goes, kept tokens might not match then
+    const std::atomic<bool>* cancel = nullptr; // set by another thread to abandon the running evaluation
+
+    int Intern(const std::string& name);
+    CalcStatus Execute(const Bytecode& program, std::vector<double>& stack, size_t frame, std::vector<int>& processed, double& result);
+    CalcStatus Evaluate(const Bytecode& program, double& result);
+    CalcStatus Run(const Bytecode& program, const ClosureTree* closure, std::vector<double>& stack, size_t frame, std::vector<int>& processed, double& result);
+    std::unique_ptr<ClosureTree> BuildClosure(const Bytecode& program);
+    void RefreshClosures();
+    bool CacheLookup(InputLine& function, const double* arguments, double& result);
+    void CacheStore(InputLine& function, const double* arguments, double result);
+    static double ClosureVariable(const ClosureNode& node, ClosureContext& context);
+    static double ClosureCall(const ClosureNode& node, ClosureContext& context);
+    CalcStatus Solve(OpCode code, int symbol, double target, double guess, std::vector<double>& stack, std::vector<int>& processed, double& result);
+    template<class T>
+    CalcStatus ExecuteAs(const Bytecode& program, std::vector<T>& values, size_t frame, std::vector<double>& stack, std::vector<int>& processed, TypedLines<T>& lines, T& result);
+    template<class T>
+    CalcStatus ProgramAs(int handle, TypedLines<T>& lines, const Bytecode*& program);
+    template<class T>
+    CalcStatus TypedLineValue(int handle, std::vector<T>& values, std::vector<double>& stack, std::vector<int>& processed, TypedLines<T>& lines, T& value);
+    CalcStatus LineValue(int handle, std::vector<double>& stack, std::vector<int>& processed, double& value);
+    bool Cancelled();
+    int Handle(int index);
+    CalcStatus TryParse(std::string_view str, int handle);
+    void Parse(std::string_view str, int handle);
+    CalcStatus Tokenize(std::string_view str, size_t from, size_t editEnd, size_t oldEditEnd, LineTokens& state, size_t& kept);
+    void Shunt(LineTokens& state, size_t first, size_t synced, size_t output, int stack, std::deque<PostfixItem>& postfix);
+    CalcStatus FinishParse(InputLine& line, LineTokens& state);
+    CalcStatus TryCompile(const std::deque<PostfixItem>& items, const std::vector<int>& arguments, bool fold, Bytecode& program);
+    CalcStatus CompileRange(const std::deque<PostfixItem>& items, size_t& next, const std::vector<int>& arguments, size_t functionArguments, bool fold, Bytecode& program);
+    CalcStatus Loop(OpCode code, const Bytecode& body, size_t arguments, double low, double high, std::vector<double>& stack, std::vector<int>& processed, double& result);
+    void Throw(const CalcStatus& status);
+    void Invalidate(int symbol);
+    void SetReferences(InputLine* line, const std::vector<int>& references);
+    void Define(const InputLine& line, int handle);
+    void Undefine(const InputLine& line);
+    CalcStatus ExecuteBatch(const Bytecode& program, size_t frame, std::vector<int>& processed, BatchState& state);
+    bool DependsOnBatch(int symbol, BatchState& state);
+    bool DependsOnBatch(const Bytecode& program, BatchState& state);
+    void FoldConstants(Bytecode& program);
+    CalcStatus ExpandPostfix(const std::deque<PostfixItem>& items, const std::vector<int>& argumentSymbols, const std::vector<std::vector<PostfixItem>>& arguments,
+        std::vector<PostfixItem>& output, std::vector<size_t>& starts, std::vector<int>& processed);
 
 public:
-    void AddLine(int index);
+    Calculator();
+    // everything else takes a line's index, its position in the sheet. Handles stay with a line however the lines
+    // around it move, for keeping track of a line between edits. Both ways are O(log n)
+    int AddLine(int index);
     void RemoveLine(int index);
     int LineCount();
+    int GetLineHandle(int index);
+    // throws std::out_of_range for a line that's been removed
+    int GetLineIndex(int handle);
+    const InputLine& GetLine(int index);
+    // every line that reads one of symbols, or reads a line that does, by index in order. Lines that don't parse
+    // could be reading any of them, so they're always in
+    std::vector<int> GetDependentLines(const std::vector<int>& symbols);
+    // the Try functions report failures through their status instead of throwing, the rest throw
+    // std::runtime_error with the status' message (EvaluationCancelled when cancelled)
+    CalcStatus TryGetFormattedLine(int index, std::string& output);
     std::string GetFormattedLine(int index);
-    void ParseLine(const std::string& line, int index);
-    double EvaluatePostfix(std::deque<PostfixItem> items);
-    double EvaluatePostfix(std::deque<PostfixItem> items, std::set<std::string>& processedIdentifiers, std::map<std::string, double>& calculatedVariables);
+    CalcStatus TryEvaluateLine(int index, double& value);
+    double EvaluateLine(int index);
+    // evaluates a line, and every variable it reads, in another number type. Only the arithmetic is done in T: the
+    // literals have been read into doubles already, so an interval takes in everything that rounds to them, and
+    // solve, minimize and integrate still work in double. Folding only happens for double, everything else runs
+    // programs compiled again without it, once per evaluation, so turning folding off saves the recompiling.
+    // Only compiled in for the types listed at the end of this file
+    template<class T>
+    CalcStatus TryEvaluateLineAs(int index, T& value);
+    template<class T>
+    T EvaluateLineAs(int index);
+    std::vector<LineResult> RecalculateAll();
+    CalcStatus TryEvaluateBatch(int index, const std::vector<std::string>& names, const std::vector<std::vector<double>>& columns, std::vector<double>& results);
+    std::vector<double> EvaluateBatch(int index, const std::vector<std::string>& names, const std::vector<std::vector<double>>& columns);
+    CalcStatus TryParseLine(std::string_view line, int index);
+    void ParseLine(std::string_view line, int index);
+    // replaces removed characters of a line's text at offset with inserted and parses the result. Only the tokens
+    // around the edit are read again, and shunting yard only reruns until it's back to where it was last time, as long
+    // as the edit is right of the = and no variable or function came or went since the line's last parse. Anything
+    // else parses the whole line, like the first edit of a line does to get its tokens
+    CalcStatus TryEditLine(int index, size_t offset, size_t removed, std::string_view inserted);
+    void EditLine(int index, size_t offset, size_t removed, std::string_view inserted);
+    void Compile(const std::deque<PostfixItem>& items, const std::vector<int>& arguments, Bytecode& program);
+    CalcStatus TryEvaluatePostfix(const std::deque<PostfixItem>& items, double& value);
+    double EvaluatePostfix(const std::deque<PostfixItem>& items);
+    std::string GetErrorMessage(const CalcStatus& status);
     void SetEvaluateLine(int index);
-    std::deque<PostfixItem> GetExpandedPostfix(std::deque<PostfixItem> items);
-    std::deque<PostfixItem> GetExpandedPostfix(std::deque<PostfixItem> items, std::set<std::string>& processed);
+    void SetCacheSize(size_t slots);
+    void SetConstantFolding(bool enabled);
+    void SetEvaluator(EvaluatorKind kind);
+    CacheStats GetCacheStats(int index);
+    std::deque<PostfixItem> GetExpandedPostfix(const std::deque<PostfixItem>& items);
+    std::deque<PostfixItem> GetExpandedPostfix(int index);
+    CalcStatus TryGetExpandedPostfix(int index, std::deque<PostfixItem>& expanded);
+    // turning profiling on starts every line's counters from zero
+    void SetProfiling(bool enabled);
+    bool IsProfiling();
+    LineProfile GetLineProfile(int index);
+    // checked at every line and function call an evaluation reaches, a set flag throws EvaluationCancelled.
+    // The flag has to outlive every evaluation, nullptr turns it off
+    void SetCancelFlag(const std::atomic<bool>* flag);
+    // a binary copy of every parsed line, so a big sheet can be reopened without parsing it again. sources are the
+    // lines' text, which a snapshot has to match to be loaded. Loading only works on a calculator without
+    // lines, and returns false when the snapshot is missing, from another version or doesn't match sources, in which
+    // case the sources get parsed like always
+    bool SaveSnapshot(const std::string& path, const std::vector<std::string>& sources);
+    bool LoadSnapshot(const std::string& path, const std::vector<std::string>& sources);
 
     ~Calculator() {
+        // from the back, so nothing has to shift down
         while (LineCount() != 0) {
-            RemoveLine(0);
+            RemoveLine(LineCount() - 1);
         }
     }
-};
\ No newline at end of file
+};
+
+// the types EvaluateLineAs is compiled for. double is what the calculator uses anyway, float, long double and Interval
+// only get compiled in with CALCULATOR_NUMERIC_TYPES, so a build that only needs doubles doesn't pay for them
+extern template CalcStatus Calculator::TryEvaluateLineAs<double>(int index, double& value);
+extern template double Calculator::EvaluateLineAs<double>(int index);
+#ifdef CALCULATOR_NUMERIC_TYPES
+extern template CalcStatus Calculator::TryEvaluateLineAs<float>(int index, float& value);
+extern template float Calculator::EvaluateLineAs<float>(int index);
+extern template CalcStatus Calculator::TryEvaluateLineAs<long double>(int index, long double& value);
+extern template long double Calculator::EvaluateLineAs<long double>(int index);
+extern template CalcStatus Calculator::TryEvaluateLineAs<Interval>(int index, Interval& value);
+extern template Interval Calculator::EvaluateLineAs<Interval>(int index);
+#endif
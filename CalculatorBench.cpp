@@ -0,0 +1,471 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Calculator.h"
+
+// every allocation in the process goes through here so each benchmark can report allocations per op
+static std::atomic<size_t> allocations{ 0 };
+
+// new and delete only ever meet in these two, so whatever new hands out is given back the way it was taken
+static void* Allocate(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+static void Release(void* p) noexcept {
+    std::free(p);
+}
+
+// malloc only lines up to max_align_t, so over-aligned blocks are padded and keep what malloc returned right in front
+static void* AllocateAligned(size_t size, std::align_val_t alignment) {
+    size_t align = static_cast<size_t>(alignment);
+    void* raw = Allocate(size + align + sizeof(void*));
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + align - 1) & ~(uintptr_t) (align - 1);
+    std::memcpy(reinterpret_cast<void*>(aligned - sizeof(void*)), &raw, sizeof(void*));
+    return reinterpret_cast<void*>(aligned);
+}
+
+static void ReleaseAligned(void* p) noexcept {
+    if (p != nullptr) {
+        void* raw;
+        std::memcpy(&raw, reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(p) - sizeof(void*)), sizeof(void*));
+        Release(raw);
+    }
+}
+
+void* operator new(size_t size) {
+    return Allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return Allocate(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return Allocate(size);
+    } catch (std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return operator new(size, std::nothrow);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return AllocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return AllocateAligned(size, alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    try {
+        return AllocateAligned(size, alignment);
+    } catch (std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return operator new(size, alignment, std::nothrow);
+}
+
+void operator delete(void* p) noexcept {
+    Release(p);
+}
+
+void operator delete[](void* p) noexcept {
+    Release(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    Release(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    Release(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    Release(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    Release(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    ReleaseAligned(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+    ReleaseAligned(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    ReleaseAligned(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+    ReleaseAligned(p);
+}
+
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    ReleaseAligned(p);
+}
+
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    ReleaseAligned(p);
+}
+
+struct BenchResult {
+    std::string function;
+    std::string parameter;
+    int value;
+    size_t iterations;
+    double nsPerOp;
+    double allocationsPerOp;
+    double opsPerSecond;
+};
+
+static double minTime = 0.2;
+
+// runs op until it has taken at least minTime seconds, after one untimed warm up call
+static BenchResult Measure(const std::string& function, const std::string& parameter, int value, const std::function<void()>& op) {
+    op();
+    size_t iterations{ 0 };
+    size_t batch{ 1 };
+    size_t allocated{ 0 };
+    std::chrono::duration<double> elapsed{ 0 };
+    while (elapsed.count() < minTime) {
+        size_t before = allocations.load();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i{ 0 }; i < batch; i++) {
+            op();
+        }
+        elapsed += std::chrono::steady_clock::now() - start;
+        allocated += allocations.load() - before;
+        iterations += batch;
+        batch *= 2;
+    }
+    double seconds = elapsed.count();
+    return BenchResult{ function, parameter, value, iterations, seconds * 1e9 / iterations, (double) allocated / iterations, iterations / seconds };
+}
+
+// identifiers can only contain letters. Upper case keeps them from starting with a built-in like sin or pi
+static std::string Name(const std::string& prefix, int n) {
+    std::string name = prefix;
+    do {
+        name += (char) ('A' + n % 26);
+        n /= 26;
+    } while (n != 0);
+    return name;
+}
+
+// "1 + 2 * 3 - 4 / 5 ..." with length operands
+static std::string LongExpression(int length) {
+    static const char ops[] = { '+', '*', '-', '/' };
+    std::string expression = "1";
+    for (int i{ 1 }; i < length; i++) {
+        expression += ' ';
+        expression += ops[i % 4];
+        expression += ' ';
+        expression += std::to_string(i % 9 + 1);
+    }
+    return expression;
+}
+
+// like LongExpression, but every other operand is the argument a, so none of it folds away
+static std::string ArgumentExpression(int length) {
+    static const char ops[] = { '+', '*', '-', '/' };
+    std::string expression = "a";
+    for (int i{ 1 }; i < length; i++) {
+        expression += ' ';
+        expression += ops[i % 4];
+        expression += ' ';
+        expression += i % 2 == 0 ? "a" : std::to_string(i % 9 + 1);
+    }
+    return expression;
+}
+
+// "((((1 + 1) * 2) + 1) * 2)" nested depth times
+static std::string NestedExpression(int depth) {
+    std::string expression = "1";
+    for (int i{ 0 }; i < depth; i++) {
+        expression = "(" + expression + (i % 2 == 0 ? " + 1)" : " * 2)");
+    }
+    return expression;
+}
+
+static void SetLines(Calculator& calculator, const std::vector<std::string>& lines) {
+    for (size_t i{ 0 }; i < lines.size(); i++) {
+        calculator.AddLine(i);
+        calculator.ParseLine(lines[i], i);
+    }
+}
+
+// the four entry points on the last line of a sheet
+static void BenchLine(std::vector<BenchResult>& results, const std::string& parameter, int value, const std::vector<std::string>& lines) {
+    Calculator calculator;
+    SetLines(calculator, lines);
+    int last = lines.size() - 1;
+    const std::string& source = lines.back();
+    results.push_back(Measure("ParseLine", parameter, value, [&] { calculator.ParseLine(source, last); }));
+    std::deque<PostfixItem> postfix = calculator.GetLine(last).postfix;
+    results.push_back(Measure("GetExpandedPostfix", parameter, value, [&] { calculator.GetExpandedPostfix(postfix); }));
+    results.push_back(Measure("EvaluatePostfix", parameter, value, [&] { calculator.EvaluatePostfix(postfix); }));
+    results.push_back(Measure("GetFormattedLine", parameter, value, [&] { calculator.GetFormattedLine(last); }));
+}
+
+static std::vector<BenchResult> RunAll(const std::string& filter) {
+    std::vector<BenchResult> results{};
+    auto enabled = [&](const std::string& parameter) {
+        return filter.empty() || parameter.find(filter) != std::string::npos;
+    };
+    if (enabled("length")) {
+        for (int length : { 16, 256, 4096 }) {
+            BenchLine(results, "length", length, { LongExpression(length) });
+        }
+    }
+    if (enabled("depth")) {
+        for (int depth : { 4, 32, 256 }) {
+            BenchLine(results, "depth", depth, { NestedExpression(depth) });
+        }
+    }
+    if (enabled("functions")) {
+        // each function calls the one before it
+        for (int count : { 1, 8, 64 }) {
+            std::vector<std::string> lines{ "x = 2", Name("f", 0) + "(a) = a + 1" };
+            for (int i{ 1 }; i < count; i++) {
+                lines.push_back(Name("f", i) + "(a) = " + Name("f", i - 1) + "(a) * 2");
+            }
+            lines.push_back(Name("f", count - 1) + "(x) + 1");
+            BenchLine(results, "functions", count, lines);
+        }
+    }
+    if (enabled("fanout")) {
+        // each function calls the one before it twice, so the fully expanded form doubles with every level
+        for (int count : { 4, 8, 16 }) {
+            std::vector<std::string> lines{ Name("f", 0) + "(a) = a + 1" };
+            for (int i{ 1 }; i < count; i++) {
+                lines.push_back(Name("f", i) + "(a) = " + Name("f", i - 1) + "(a) + " + Name("f", i - 1) + "(a)");
+            }
+            lines.push_back(Name("f", count - 1) + "(2)");
+            Calculator calculator;
+            SetLines(calculator, lines);
+            int last = lines.size() - 1;
+            std::deque<PostfixItem> postfix = calculator.GetLine(last).postfix;
+            results.push_back(Measure("EvaluatePostfix", "fanout", count, [&] { calculator.EvaluatePostfix(postfix); }));
+            results.push_back(Measure("GetFormattedLine", "fanout", count, [&] { calculator.GetFormattedLine(last - 1); }));
+        }
+    }
+    if (enabled("evaluator")) {
+        // the same function body run by each evaluator, with the call cache off so every call does the work
+        for (int length : { 16, 256, 4096 }) {
+            std::vector<std::string> lines{ "F(a) = " + ArgumentExpression(length), "F(3)" };
+            for (EvaluatorKind kind : { EKBytecode, EKClosure }) {
+                Calculator calculator;
+                calculator.SetCacheSize(0);
+                calculator.SetEvaluator(kind);
+                SetLines(calculator, lines);
+                std::deque<PostfixItem> postfix = calculator.GetLine(1).postfix;
+                results.push_back(Measure("EvaluatePostfix", kind == EKBytecode ? "evaluator-bytecode" : "evaluator-closure", length, [&] {
+                    calculator.EvaluatePostfix(postfix);
+                }));
+            }
+        }
+    }
+    if (enabled("chain")) {
+        // a chain of variables, the edit is to the head of it so everything after has to be recalculated
+        for (int depth : { 1, 16, 256 }) {
+            std::vector<std::string> lines{ Name("v", 0) + " = 1" };
+            for (int i{ 1 }; i < depth; i++) {
+                lines.push_back(Name("v", i) + " = " + Name("v", i - 1) + " + 1");
+            }
+            lines.push_back(Name("v", depth - 1) + " * 2");
+            BenchLine(results, "chain", depth, lines);
+            Calculator calculator;
+            SetLines(calculator, lines);
+            int last = lines.size() - 1;
+            results.push_back(Measure("EditHead", "chain", depth, [&] {
+                calculator.ParseLine(lines[0], 0);
+                calculator.GetFormattedLine(last);
+            }));
+        }
+    }
+    if (enabled("sheet")) {
+        // independent groups of a few lines each, recalculated in full after every line is touched
+        for (int size : { 100, 1000, 5000 }) {
+            std::vector<std::string> lines{};
+            for (int i{ 0 }; (int) lines.size() < size; i++) {
+                std::string a = Name("s", i * 2);
+                std::string b = Name("s", i * 2 + 1);
+                lines.push_back(a + " = " + std::to_string(i) + " + 1");
+                lines.push_back(b + " = " + a + " * 2 + sqrt(" + a + ")");
+                lines.push_back(b + " / 3 + sin(" + a + ")");
+            }
+            lines.resize(size);
+            Calculator calculator;
+            SetLines(calculator, lines);
+            results.push_back(Measure("GetFormattedLine", "sheet", size, [&] {
+                for (int i{ 0 }; i < size; i++) {
+                    calculator.ParseLine(lines[i], i);
+                }
+                for (int i{ 0 }; i < size; i++) {
+                    try {
+                        calculator.GetFormattedLine(i);
+                    } catch (std::exception&) {
+                    }
+                }
+            }));
+            results.push_back(Measure("RecalculateAll", "sheet", size, [&] {
+                for (int i{ 0 }; i < size; i++) {
+                    calculator.ParseLine(lines[i], i);
+                }
+                calculator.RecalculateAll();
+            }));
+        }
+    }
+    if (enabled("snapshot")) {
+        // reopening a sheet, parsing every line against loading the snapshot of it
+        for (int size : { 1000, 10000, 50000 }) {
+            std::vector<std::string> lines{};
+            for (int i{ 0 }; (int) lines.size() < size; i++) {
+                std::string a = Name("s", i * 2);
+                std::string b = Name("s", i * 2 + 1);
+                lines.push_back(a + " = " + std::to_string(i) + " + 1");
+                lines.push_back(b + " = " + a + " * 2 + sqrt(" + a + ")");
+                lines.push_back(b + " / 3 + sin(" + a + ")");
+            }
+            lines.resize(size);
+            std::string path = "calculator-bench.snapshot";
+            {
+                Calculator calculator;
+                SetLines(calculator, lines);
+                calculator.SaveSnapshot(path, lines);
+            }
+            results.push_back(Measure("ParseLine", "snapshot", size, [&] {
+                Calculator calculator;
+                SetLines(calculator, lines);
+            }));
+            results.push_back(Measure("LoadSnapshot", "snapshot", size, [&] {
+                Calculator calculator;
+                calculator.LoadSnapshot(path, lines);
+            }));
+            std::remove(path.c_str());
+        }
+    }
+    if (enabled("solve")) {
+        // a sheet of solves of the same two functions, recalculated after the variable they both read changes
+        for (int size : { 10, 100, 500 }) {
+            std::vector<std::string> lines{ "T = 1", "F(x) = x^3 + x*T - exp(x/10)", "G(x) = (x - T)^2 + sin(x)" };
+            for (int i{ 0 }; i < size; i++) {
+                lines.push_back(Name("S", i) + " = solve(F, " + std::to_string(i) + ", 1) + minimize(G, " + std::to_string(i % 7) + ")");
+            }
+            Calculator calculator;
+            SetLines(calculator, lines);
+            int t{ 0 };
+            results.push_back(Measure("RecalculateAll", "solve", size, [&] {
+                calculator.ParseLine("T = " + std::to_string(t++ % 5 + 1), 0);
+                calculator.RecalculateAll();
+            }));
+        }
+    }
+    if (enabled("loops")) {
+        // the same sum and integral over longer and longer ranges, one compiled body run over and over
+        for (int size : { 100, 1000, 10000 }) {
+            Calculator calculator;
+            SetLines(calculator, { "T = 1", "A = sum(1/(k*k + T), k, 1, " + std::to_string(size) + ")",
+                "B = integrate(sin(x*x/10)*exp(0 - x/T), x, 0, " + std::to_string(size / 100) + ")" });
+            int t{ 0 };
+            results.push_back(Measure("sum", "loops", size, [&] {
+                calculator.ParseLine("T = " + std::to_string(t++ % 5 + 1), 0);
+                calculator.EvaluateLine(1);
+            }));
+            results.push_back(Measure("integrate", "loops", size, [&] {
+                calculator.ParseLine("T = " + std::to_string(t++ % 5 + 1), 0);
+                calculator.EvaluateLine(2);
+            }));
+        }
+    }
+    if (enabled("edit")) {
+        // one digit in the middle of a long line changed back and forth, parsing the whole line against the edit
+        for (int length : { 256, 4096, 65536 }) {
+            std::string source = "E = " + ArgumentExpression(length);
+            size_t middle = source.find_first_of("123456789", source.size() / 2);
+            Calculator calculator;
+            SetLines(calculator, { "a = 2", source });
+            bool flip{ false };
+            results.push_back(Measure("ParseLine", "edit", length, [&] {
+                source[middle] = (flip = !flip) ? '1' : '2';
+                calculator.ParseLine(source, 1);
+            }));
+            results.push_back(Measure("EditLine", "edit", length, [&] {
+                calculator.EditLine(1, middle, 1, (flip = !flip) ? "1" : "2");
+            }));
+        }
+    }
+    return results;
+}
+
+static std::string ToJson(const std::vector<BenchResult>& results) {
+    std::ostringstream out;
+    out << "{\n  \"benchmarks\": [";
+    for (size_t i{ 0 }; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {\"name\": \"" << r.function << "/" << r.parameter << ":" << r.value << "\", "
+            << "\"function\": \"" << r.function << "\", "
+            << "\"parameter\": \"" << r.parameter << "\", "
+            << "\"value\": " << r.value << ", "
+            << "\"iterations\": " << r.iterations << ", "
+            << "\"ns_per_op\": " << r.nsPerOp << ", "
+            << "\"allocations_per_op\": " << r.allocationsPerOp << ", "
+            << "\"ops_per_second\": " << r.opsPerSecond << "}";
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+// usage: calculator-bench [--filter length|depth|functions|fanout|evaluator|chain|sheet|snapshot|solve|loops|edit] [--min-time seconds] [--output file.json]
+int main(int argc, char** argv) {
+    std::string filter{};
+    std::string output{};
+    for (int i{ 1 }; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            minTime = std::atof(argv[++i]);
+        } else if (arg == "--output" && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--filter name] [--min-time seconds] [--output file.json]" << std::endl;
+            return 2;
+        }
+    }
+    std::string json = ToJson(RunAll(filter));
+    if (output.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream(output) << json;
+    }
+    return 0;
+}
@@ -0,0 +1,310 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <cstdio>
+#include <algorithm>
+#include <thread>
+#include <limits>
+
+#include "Calculator.h"
+#include "ThreadPool.h"
+
+// what a line evaluated to, the same way for worksheets and streams
+static void AppendResult(std::string& out, Calculator& calculator, int index, const LineResult& result) {
+    const InputLine& line = calculator.GetLine(index);
+    char number[64];
+    if (!result.ok) {
+        out += "Error: ";
+        out += result.error;
+    } else if (line.type == InputLineType::ILFunction) {
+        std::string formatted{};
+        CalcStatus status = calculator.TryGetFormattedLine(index, formatted);
+        if (status.Ok()) {
+            out += formatted;
+        } else {
+            out += "Error: ";
+            out += calculator.GetErrorMessage(status);
+        }
+    } else {
+        if (line.type == InputLineType::ILVariable) {
+            out += line.identifier;
+            out += " = ";
+        }
+        // same format as std::to_string, without the temporary
+        std::snprintf(number, sizeof(number), "%f", result.value);
+        out += number;
+    }
+    out += '\n';
+}
+
+#ifdef CALCULATOR_NUMERIC_TYPES
+// every digit the type has, with no fixed number of decimals to hide them behind
+static void AppendNumber(std::string& out, long double value, int digits) {
+    char number[64];
+    std::snprintf(number, sizeof(number), "%.*Lg", digits, value);
+    out += number;
+}
+
+static void AppendNumber(std::string& out, const Interval& value, int digits) {
+    out += '[';
+    AppendNumber(out, value.low, digits);
+    out += ", ";
+    AppendNumber(out, value.high, digits);
+    out += ']';
+}
+
+// same as AppendResult, for a variable or expression evaluated in T
+template<class T>
+static void AppendTyped(std::string& out, Calculator& calculator, int index, int digits) {
+    const InputLine& line = calculator.GetLine(index);
+    T value;
+    CalcStatus status = calculator.TryEvaluateLineAs(index, value);
+    if (!status.Ok()) {
+        out += "Error: ";
+        out += calculator.GetErrorMessage(status);
+    } else {
+        if (line.type == InputLineType::ILVariable) {
+            out += line.identifier;
+            out += " = ";
+        }
+        AppendNumber(out, value, digits);
+    }
+    out += '\n';
+}
+#endif
+
+static bool IsBlank(std::string_view source) {
+    return source.find_first_not_of(" \t") == std::string_view::npos;
+}
+
+// loads a worksheet, one line of input per line of the file, and prints what each line evaluates to.
+// with a snapshot the parsed sheet is loaded from it when it matches the file, and written to it when it doesn't.
+// type picks another number type than double to evaluate in
+static int RunWorksheet(std::istream& in, const std::string& snapshot, const std::string& type) {
+    std::vector<std::string> sources{};
+    std::string source;
+    while (std::getline(in, source)) {
+        if (!source.empty() && source.back() == '\r') {
+            source.pop_back();
+        }
+        sources.push_back(source);
+    }
+
+    Calculator calculator;
+    // other types evaluate without folding anyway, no need to fold for the double results nobody asked for
+    calculator.SetConstantFolding(type.empty() || type == "double");
+    bool loaded = !snapshot.empty() && calculator.LoadSnapshot(snapshot, sources);
+    if (!loaded) {
+        for (size_t i{ 0 }; i < sources.size(); i++) {
+            calculator.AddLine(i);
+        }
+        // lines can use things defined further down, those get parsed again when they're evaluated
+        for (size_t i{ 0 }; i < sources.size(); i++) {
+            calculator.TryParseLine(sources[i], i);
+        }
+    }
+    std::vector<LineResult> results = calculator.RecalculateAll();
+    if (!loaded && !snapshot.empty() && !calculator.SaveSnapshot(snapshot, sources)) {
+        std::cerr << "cannot write " << snapshot << std::endl;
+    }
+    std::string out{};
+    for (size_t i{ 0 }; i < sources.size(); i++) {
+        if (IsBlank(sources[i])) {
+            out += '\n';
+            continue;
+        }
+#ifdef CALCULATOR_NUMERIC_TYPES
+        if (!type.empty() && calculator.GetLine(i).type != InputLineType::ILFunction) {
+            if (type == "float") {
+                AppendTyped<float>(out, calculator, i, std::numeric_limits<float>::max_digits10);
+            } else if (type == "double") {
+                AppendTyped<double>(out, calculator, i, std::numeric_limits<double>::max_digits10);
+            } else if (type == "long") {
+                AppendTyped<long double>(out, calculator, i, std::numeric_limits<long double>::max_digits10);
+            } else {
+                AppendTyped<Interval>(out, calculator, i, std::numeric_limits<double>::max_digits10);
+            }
+            continue;
+        }
+#endif
+        AppendResult(out, calculator, i, results[i]);
+    }
+    std::cout << out;
+    return 0;
+}
+
+// a chunk of the input, worked on as a whole by one worker
+struct StreamBatch {
+    std::vector<char> text; // whole lines only, the partial line at the end of a read moves on to the next batch
+    std::string output;
+    bool done;
+};
+
+// evaluates every line of the input on its own, for inputs far too big to be one worksheet. Chunks are read
+// into a fixed number of batches that the workers fill with output, and the batches are written back in order,
+// so memory stays the same however long the input is
+static int RunStream(std::istream& in, std::ostream& out, size_t threadCount, size_t chunkSize) {
+    ThreadPool pool{ threadCount };
+    size_t batchCount = pool.Size() * 2 + 2;
+    std::vector<std::unique_ptr<StreamBatch>> batches{};
+    for (size_t i{ 0 }; i < batchCount; i++) {
+        batches.push_back(std::make_unique<StreamBatch>());
+    }
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::deque<StreamBatch*> inFlight{};
+    std::vector<char> carry{}; // start of a line that didn't fit in the last chunk
+    auto work = [&](StreamBatch* batch) {
+        // one calculator per batch, its only line is parsed again for every input line. Every name a line defines
+        // gets interned for good, kept any longer they'd pile up over the whole input
+        Calculator calculator;
+        calculator.AddLine(0);
+        std::string_view text{ batch->text.data(), batch->text.size() };
+        batch->output.clear();
+        while (!text.empty()) {
+            size_t end = text.find('\n');
+            std::string_view source = text.substr(0, end);
+            text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+            if (!source.empty() && source.back() == '\r') {
+                source.remove_suffix(1);
+            }
+            if (IsBlank(source)) {
+                batch->output += '\n';
+                continue;
+            }
+            LineResult result{ true, 0, "" };
+            CalcStatus status = calculator.TryParseLine(source, 0);
+            if (status.Ok() && calculator.GetLine(0).type != InputLineType::ILFunction) {
+                status = calculator.TryEvaluateLine(0, result.value);
+            }
+            if (!status.Ok()) {
+                result = LineResult{ false, 0, calculator.GetErrorMessage(status) };
+            }
+            AppendResult(batch->output, calculator, 0, result);
+        }
+        std::lock_guard<std::mutex> lock{ mutex };
+        batch->done = true;
+        finished.notify_all();
+    };
+    // writes the oldest batch once it's done, which frees it up for the reader
+    auto writeOldest = [&] {
+        StreamBatch* batch = inFlight.front();
+        {
+            std::unique_lock<std::mutex> lock{ mutex };
+            finished.wait(lock, [&] { return batch->done; });
+        }
+        out.write(batch->output.data(), batch->output.size());
+        inFlight.pop_front();
+        return batch;
+    };
+    size_t next{ 0 };
+    bool eof{ false };
+    while (!eof) {
+        StreamBatch* batch = inFlight.size() == batchCount ? writeOldest() : batches[next++].get();
+        batch->done = false;
+        batch->text.swap(carry);
+        carry.clear();
+        size_t start = batch->text.size();
+        batch->text.resize(start + chunkSize);
+        in.read(batch->text.data() + start, chunkSize);
+        batch->text.resize(start + in.gcount());
+        eof = !in;
+        if (!eof) {
+            // hand the unfinished last line on. A line longer than a whole chunk just keeps growing the carry
+            auto last = std::find(batch->text.rbegin(), batch->text.rend(), '\n');
+            carry.assign(last.base(), batch->text.end());
+            batch->text.erase(last.base(), batch->text.end());
+        } else if (!batch->text.empty() && batch->text.back() != '\n') {
+            batch->text.push_back('\n');
+        }
+        inFlight.push_back(batch);
+        pool.Submit([&work, batch] { work(batch); });
+    }
+    while (!inFlight.empty()) {
+        writeOldest();
+    }
+    out.flush();
+    return out ? 0 : 1;
+}
+
+static int Usage(const char* program) {
+#ifdef CALCULATOR_NUMERIC_TYPES
+    std::cerr << "usage: " << program << " <worksheet | -> [--snapshot file] [--type float|double|long|interval]" << std::endl;
+#else
+    std::cerr << "usage: " << program << " <worksheet | -> [--snapshot file]" << std::endl;
+#endif
+    std::cerr << "       " << program << " --stream <input | -> [--output file] [--threads n] [--chunk bytes]" << std::endl;
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    bool stream{ false };
+    std::string input{};
+    std::string output{};
+    std::string snapshot{};
+    std::string type{};
+    size_t threads{ 0 };
+    size_t chunkSize{ 1 << 20 };
+    for (int i{ 1 }; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--stream") {
+            stream = true;
+        } else if ((arg == "--output" || arg == "--threads" || arg == "--chunk" || arg == "--snapshot" || arg == "--type") && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (arg == "--output") {
+                output = value;
+            } else if (arg == "--snapshot") {
+                snapshot = value;
+            } else if (arg == "--type") {
+                type = value;
+            } else if (arg == "--threads") {
+                threads = std::stoul(value);
+            } else {
+                chunkSize = std::max<size_t>(std::stoul(value), 1);
+            }
+        } else if (input.empty() && (arg == "-" || arg[0] != '-')) {
+            input = arg;
+        } else {
+            return Usage(argv[0]);
+        }
+    }
+    bool typed{ false };
+#ifdef CALCULATOR_NUMERIC_TYPES
+    typed = type == "float" || type == "double" || type == "long" || type == "interval";
+#endif
+    if (input.empty() || (!stream && (!output.empty() || threads != 0)) || (stream && !snapshot.empty()) || (!type.empty() && (stream || !typed))) {
+        return Usage(argv[0]);
+    }
+    std::ifstream file;
+    std::istream* in = &std::cin;
+    if (input != "-") {
+        file.open(input, std::ios::binary);
+        if (!file) {
+            std::cerr << "cannot open " << input << std::endl;
+            return 1;
+        }
+        in = &file;
+    }
+    if (!stream) {
+        return RunWorksheet(*in, snapshot, type);
+    }
+    std::ofstream outFile;
+    std::ostream* out = &std::cout;
+    if (!output.empty() && output != "-") {
+        outFile.open(output, std::ios::binary);
+        if (!outFile) {
+            std::cerr << "cannot open " << output << std::endl;
+            return 1;
+        }
+        out = &outFile;
+    }
+    std::ios::sync_with_stdio(false);
+    return RunStream(*in, *out, threads == 0 ? std::thread::hardware_concurrency() : threads, chunkSize);
+}
@@ -0,0 +1,645 @@
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "AsyncEvaluator.h"
+#include "Calculator.h"
+
+// regression checks for the engine, run by ctest. Every failed check is reported and the exit code is the count
+static int failures{ 0 };
+
+static void Check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+static bool Same(double a, double b) {
+    return a == b || (std::isnan(a) && std::isnan(b));
+}
+
+// the same double down to the sign and payload of a NaN
+static bool SameBits(double a, double b) {
+    return std::memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+// lines that fail to parse stay in, evaluating them reports the error
+static void SetLines(Calculator& calculator, const std::vector<std::string>& lines) {
+    for (size_t i{ 0 }; i < lines.size(); i++) {
+        calculator.AddLine(i);
+    }
+    for (size_t i{ 0 }; i < lines.size(); i++) {
+        calculator.TryParseLine(lines[i], i);
+    }
+}
+
+// a function line has no arguments to read outside of a call, evaluating it used to read past the value stack
+static void TestFunctionLine() {
+    Calculator calculator;
+    SetLines(calculator, { "f(x) = x + 1", "f(2)" });
+    double value;
+    Check(calculator.TryEvaluateLine(0, value).code == ECFunctionLine, "TryEvaluateLine on a function line");
+    Check(calculator.TryEvaluateLine(1, value).Ok() && value == 3, "calling the function after evaluating its line");
+    bool thrown{ false };
+    try {
+        calculator.EvaluateLine(0);
+    } catch (std::runtime_error&) {
+        thrown = true;
+    }
+    Check(thrown, "EvaluateLine on a function line throws");
+    thrown = false;
+    try {
+        calculator.EvaluateBatch(0, {}, {});
+    } catch (std::runtime_error&) {
+        thrown = true;
+    }
+    Check(thrown, "EvaluateBatch on a function line throws");
+#ifdef CALCULATOR_NUMERIC_TYPES
+    Interval interval;
+    Check(calculator.TryEvaluateLineAs<Interval>(0, interval).code == ECFunctionLine, "TryEvaluateLineAs on a function line");
+#endif
+}
+
+// a line is only worked out again once something it reads changes
+static void TestDirtyDependents() {
+    Calculator calculator;
+    SetLines(calculator, { "a = 1", "b = a + 1", "c = 10", "b * c" });
+    calculator.SetProfiling(true);
+    double value;
+    Check(calculator.TryEvaluateLine(3, value).Ok() && value == 20, "b * c");
+    calculator.ParseLine("a = 5", 0);
+    Check(calculator.TryEvaluateLine(3, value).Ok() && value == 60, "b * c after a changed");
+    Check(calculator.GetLineProfile(1).evaluations == 2, "b is recalculated after a changed");
+    Check(calculator.GetLineProfile(2).evaluations == 1, "c keeps its cached value");
+    Check(calculator.TryEvaluateLine(3, value).Ok() && value == 60 && calculator.GetLineProfile(3).evaluations == 2, "nothing changed, nothing recalculated");
+}
+
+// an edit shows again every line that reads the edited one, however indirectly
+static void TestEditedDependents() {
+    Calculator calculator;
+    SetLines(calculator, { "a = 1", "b = a + 1", "c = b * 2", "d = 5", "c + d", "e + 1" });
+    Check(calculator.GetDependentLines({ calculator.GetLine(0).symbol }) == std::vector<int>{ 1, 2, 4, 5 }, "lines reading a");
+    Check(calculator.GetDependentLines({ calculator.GetLine(3).symbol }) == std::vector<int>{ 4, 5 }, "lines reading d, and the one that doesn't parse");
+    // the calculator is the worker's from here on
+    std::vector<int> handles{};
+    for (int i{ 0 }; i < calculator.LineCount(); i++) {
+        handles.push_back(calculator.GetLineHandle(i));
+    }
+    std::mutex mutex;
+    std::condition_variable posted;
+    std::map<int, AsyncResult> results{}; // by handle, the latest
+    AsyncEvaluator evaluator{ calculator, [&](AsyncResult result) {
+        std::lock_guard<std::mutex> lock{ mutex };
+        results[result.handle] = std::move(result);
+        posted.notify_all();
+    }, std::chrono::milliseconds(1) };
+    auto wait = [&](int index, const std::string& text) {
+        std::unique_lock<std::mutex> lock{ mutex };
+        return posted.wait_for(lock, std::chrono::seconds(10), [&] { return results.count(handles[index]) != 0 && results[handles[index]].text == text; });
+    };
+    uint64_t generation = evaluator.Edit(0, "a = 2");
+    Check(wait(4, "11.000000"), "c + d is shown again after a changed");
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        const AsyncResult& edited = results[handles[0]];
+        const AsyncResult& dependent = results[handles[2]];
+        Check(edited.edited && edited.generation == generation, "the edited line's result");
+        Check(!dependent.edited && dependent.generation == generation, "c's result");
+        Check(results.count(handles[3]) == 0, "d doesn't read a");
+    }
+    // defining a name shows the lines that couldn't read it so far
+    evaluator.Edit(3, "e = 2");
+    Check(wait(5, "3.000000"), "e + 1 is shown once e is defined");
+    evaluator.Stop();
+}
+
+// lines left over in a cycle get the error evaluating them one at a time gives
+static void TestCycleErrors() {
+    std::vector<std::string> lines{ "a = b + 1", "b = a + 1", "f(x) = g(x)", "g(x) = f(x)", "f(1)", "c = a" };
+    Calculator sequential;
+    Calculator recalculated;
+    SetLines(sequential, lines);
+    SetLines(recalculated, lines);
+    std::vector<LineResult> results = recalculated.RecalculateAll();
+    for (size_t i{ 0 }; i < lines.size(); i++) {
+        if (sequential.GetLine(i).type == InputLineType::ILFunction) {
+            continue;
+        }
+        double value;
+        CalcStatus status = sequential.TryEvaluateLine(i, value);
+        Check(!status.Ok() && !results[i].ok && results[i].error == sequential.GetErrorMessage(status), "RecalculateAll reports \"" + lines[i] + "\" like TryEvaluateLine");
+    }
+}
+
+// identifiers are letters only
+static std::string Letters(int n) {
+    std::string name{};
+    do {
+        name += (char) ('a' + n % 26);
+        n /= 26;
+    } while (n != 0);
+    return name;
+}
+
+// enough independent chains for the pool to split them up, every line has to come out as it does on its own
+static void TestRecalculateAll() {
+    std::vector<std::string> lines{};
+    for (int chain{ 0 }; chain < 50; chain++) {
+        std::string name = "v" + Letters(chain) + "x";
+        lines.push_back(name + "a = " + std::to_string(chain));
+        for (int link{ 1 }; link < 20; link++) {
+            lines.push_back(name + Letters(link) + " = " + name + Letters(link - 1) + " * 2 - " + std::to_string(link));
+        }
+    }
+    lines.push_back("vdxt + vxbxh / vaxc");
+    Calculator sequential;
+    Calculator recalculated;
+    SetLines(sequential, lines);
+    SetLines(recalculated, lines);
+    std::vector<LineResult> results = recalculated.RecalculateAll();
+    for (size_t i{ 0 }; i < lines.size(); i++) {
+        double value;
+        CalcStatus status = sequential.TryEvaluateLine(i, value);
+        Check(status.Ok() && results[i].ok && results[i].value == value, "RecalculateAll evaluates \"" + lines[i] + "\" like TryEvaluateLine");
+    }
+}
+
+// function lines print with every call expanded
+static void TestFormatting() {
+    Calculator calculator;
+    SetLines(calculator, { "f(x) = x + 1", "g(y) = f(y) * 2", "u(x) = x", "h(z) = u(z) + 1" });
+    std::string output;
+    Check(calculator.TryGetFormattedLine(1, output).Ok() && output == "g(y) = y 1.000000 + 2.000000 * ", "g prints expanded, got \"" + output + "\"");
+    calculator.ParseLine("5", 2);
+    Check(calculator.TryGetFormattedLine(3, output).code == ECUndefined && output.empty(), "a call to a function that's gone fails to format");
+}
+
+// calls run on frames of their own rather than being inlined, so a long chain of them costs nothing extra
+static void TestCallChain() {
+    std::vector<std::string> lines{ "fa(x) = x + 1" };
+    for (int i{ 1 }; i < 300; i++) {
+        lines.push_back("f" + Letters(i) + "(x) = f" + Letters(i - 1) + "(x) * 1 + 1");
+    }
+    lines.push_back("f" + Letters(299) + "(0)");
+    lines.push_back("r(x) = s(x)");
+    lines.push_back("s(x) = r(x + 1)");
+    lines.push_back("r(1)");
+    Calculator calculator;
+    SetLines(calculator, lines);
+    double value;
+    Check(calculator.TryEvaluateLine(300, value).Ok() && value == 300, "300 nested calls");
+    Check(calculator.TryEvaluateLine(303, value).code == ECRecursion, "calls that go round in a circle");
+}
+
+// the closure evaluator has to give exactly what the bytecode gives, values and errors alike
+static void TestClosureMatchesBytecode() {
+    std::vector<std::string> lines{
+        "a = 3",
+        "b = a * 2 - 1 / a",
+        "f(x) = x^2 + a*x - b",
+        "g(x, y) = f(x) * f(y) / (x - y)",
+        "h(x) = g(x, x + 1) + sin(x) * cos(x) - sqrt(x)",
+        "h(2)",
+        "g(1, 1)",
+        "f(0 - 1.5) + h(b)",
+        "k(x) = k(x - 1)",
+        "k(3)",
+        "f(1, 2)",
+        "m(x) = x - undefined",
+        "m(1)",
+        "solve(f, 4, 1)",
+        "minimize(f, 0)",
+        "sum(f(i), i, 1, 20)",
+        "integrate(h(x), x, 1, 2)",
+        "c = d + 1",
+        "d = c + 1",
+        "2 ^ 0.5 * (1 + a) / (b - 5)",
+        "((1 + 2) * (3 - 4)) / 0",
+    };
+    for (bool folding : { true, false }) {
+        Calculator bytecode;
+        Calculator closure;
+        bytecode.SetConstantFolding(folding);
+        closure.SetConstantFolding(folding);
+        closure.SetEvaluator(EKClosure);
+        SetLines(bytecode, lines);
+        SetLines(closure, lines);
+        std::string mode = folding ? " with folding" : " without folding";
+        for (size_t i{ 0 }; i < lines.size(); i++) {
+            double expected{ 0 }, value{ 0 };
+            CalcStatus want = bytecode.TryEvaluateLine(i, expected);
+            CalcStatus got = closure.TryEvaluateLine(i, value);
+            Check(want.code == got.code && (!want.Ok() || Same(expected, value)), "closure evaluates \"" + lines[i] + "\" like bytecode" + mode);
+        }
+        std::vector<LineResult> want = bytecode.RecalculateAll();
+        std::vector<LineResult> got = closure.RecalculateAll();
+        for (size_t i{ 0 }; i < lines.size(); i++) {
+            Check(want[i].ok == got[i].ok && want[i].error == got[i].error && Same(want[i].value, got[i].value),
+                "closure recalculates \"" + lines[i] + "\" like bytecode" + mode);
+        }
+        // redefining a function leaves the trees calling it stale
+        bytecode.ParseLine("f(x) = x^3 - a", 2);
+        closure.ParseLine("f(x) = x^3 - a", 2);
+        for (size_t i{ 0 }; i < lines.size(); i++) {
+            double expected{ 0 }, value{ 0 };
+            CalcStatus want = bytecode.TryEvaluateLine(i, expected);
+            CalcStatus got = closure.TryEvaluateLine(i, value);
+            Check(want.code == got.code && (!want.Ok() || Same(expected, value)), "closure evaluates \"" + lines[i] + "\" like bytecode after a redefinition" + mode);
+        }
+    }
+}
+
+static void TestSumsAndIntegrals() {
+    Calculator calculator;
+    SetLines(calculator, { "integrate(x^2, x, 0, 3)", "integrate(sin(1/x), x, 0.0001, 1)", "sum(k^2, k, 1, 10)", "integrate(sin(x), x, 0, pi)",
+        "n = 4", "sum(sum(j * n, j, 1, k), k, 1, n)", "sum(k, k)" });
+    double value;
+    Check(calculator.TryEvaluateLine(0, value).Ok() && std::fabs(value - 9) < 1e-9, "integrate(x^2, x, 0, 3)");
+    Check(calculator.TryEvaluateLine(1, value).code == ECNoIntegral, "an integral that doesn't converge is an error");
+    Check(calculator.TryEvaluateLine(2, value).Ok() && value == 385, "sum(k^2, k, 1, 10)");
+    Check(calculator.TryEvaluateLine(3, value).Ok() && std::fabs(value - 2) < 1e-9, "integrate(sin(x), x, 0, pi)");
+    Check(calculator.TryEvaluateLine(5, value).Ok() && value == 80, "a sum inside a sum, reading a variable");
+    Check(!calculator.TryEvaluateLine(6, value).Ok(), "a sum without bounds");
+}
+
+static void TestLiterals() {
+    Calculator calculator;
+    SetLines(calculator, { "0.1", "123.456", ".5", "5.", "1.2.3", "0.3 - 0.1*3" });
+    double value;
+    Check(calculator.TryEvaluateLine(0, value).Ok() && value == 0.1, "0.1 is the double nearest to it");
+    Check(calculator.TryEvaluateLine(1, value).Ok() && value == 123.456, "123.456 is the double nearest to it");
+    Check(calculator.TryEvaluateLine(2, value).Ok() && value == 0.5, ".5");
+    Check(calculator.TryEvaluateLine(3, value).Ok() && value == 5, "5.");
+    Check(calculator.TryEvaluateLine(4, value).code == ECTwoDecimalPoints, "two points in a number");
+    Check(calculator.TryEvaluateLine(5, value).Ok() && value == 0.3 - 0.1 * 3, "literals match the compiler's");
+}
+
+#ifdef CALCULATOR_NUMERIC_TYPES
+// an interval has to hold the exact result, which it can't once folding has rounded the sum in double
+static void TestIntervals() {
+    std::string tenth{ "0.1" };
+    for (int i{ 1 }; i < 100; i++) {
+        tenth += " + 0.1";
+    }
+    for (bool fold : { true, false }) {
+        Calculator calculator;
+        calculator.SetConstantFolding(fold);
+        SetLines(calculator, { "a = " + tenth, "f(x) = x * (" + tenth + ")", "a - 10", "f(1)" });
+        std::string mode{ fold ? " with folding" : " without folding" };
+        Interval value;
+        Check(calculator.TryEvaluateLineAs(0, value).Ok() && value.low <= 10 && 10 <= value.high, "a hundred tenths hold 10" + mode);
+        Check(calculator.TryEvaluateLineAs(2, value).Ok() && value.low <= 0 && 0 <= value.high, "a - 10 holds 0" + mode);
+        Check(calculator.TryEvaluateLineAs(3, value).Ok() && value.low <= 10 && 10 <= value.high, "the function body holds 10" + mode);
+        double exact;
+        Check(calculator.TryEvaluateLine(2, exact).Ok() && exact != 0, "double still rounds" + mode);
+    }
+    Calculator calculator;
+    SetLines(calculator, { "1 / 0", "0 / 0", "1 / (0.5 - 1.5)", "2 / (0.1 - 0.1)", "sum(k, k, 1, 4)", "sum(k, k, 0.1, 3)",
+        "sum(k, k, 1, 3 + 0.1)", "f(x) = x^2", "solve(f, 0.25, 1.5)" });
+    Interval value;
+    for (int i : { 0, 1, 3 }) {
+        Check(calculator.TryEvaluateLineAs(i, value).Ok() && value.low == -INFINITY && value.high == INFINITY, "dividing by a range with 0 in it gives everything, line " + std::to_string(i));
+    }
+    Check(calculator.TryEvaluateLineAs(2, value).Ok() && value.low <= -1 && -1 <= value.high && value.high < 0, "1 / -1");
+    Check(calculator.TryEvaluateLineAs(4, value).Ok() && value.low <= 10 && 10 <= value.high, "a sum with whole bounds");
+    Check(calculator.TryEvaluateLineAs(5, value).code == ECInexactBounds, "a sum from 0.1");
+    Check(calculator.TryEvaluateLineAs(6, value).code == ECInexactBounds, "a sum up to 3.1");
+    Check(calculator.TryEvaluateLineAs(8, value).Ok() && value.low == -INFINITY && value.high == INFINITY, "solve takes a target that's a range");
+}
+#endif
+
+// names are matched longest first, and go from the trie as soon as the line defining them does
+static void TestIdentifiers() {
+    Calculator calculator;
+    SetLines(calculator, { "x = 1", "xx = 2", "x + xx", "f(x) = x * 3", "f(5) + x", "sqrt(xx * 8)", "q + 1" });
+    double value;
+    Check(calculator.TryEvaluateLine(2, value).Ok() && value == 3, "xx isn't read as x twice");
+    Check(calculator.TryEvaluateLine(4, value).Ok() && value == 16, "an argument hides a variable of the same name");
+    Check(calculator.TryEvaluateLine(5, value).Ok() && value == 4, "built-in functions");
+    Check(calculator.TryEvaluateLine(6, value).code == ECUnknownIdentifier, "a name nothing defines");
+    calculator.ParseLine("y = 2", 1);
+    Check(calculator.TryEvaluateLine(2, value).code == ECUndefined, "a line reading a name that's gone");
+    calculator.ParseLine("q = 4", 1);
+    Check(calculator.TryEvaluateLine(6, value).Ok() && value == 5, "a name defined after the line using it");
+}
+
+// every row of a batch comes out as it does with the bound variable set to that row's value, past one block of rows too
+static void TestBatch() {
+    Calculator calculator;
+    SetLines(calculator, { "x = 0", "a = 2", "f(t) = t^2 + a", "y = x * a", "f(x) + y - sin(x) / a" });
+    std::vector<double> xs{};
+    for (int i{ 0 }; i < 600; i++) {
+        xs.push_back(i * 0.25); // exactly what to_string prints
+    }
+    std::vector<double> results = calculator.EvaluateBatch(4, { "x" }, { xs });
+    Check(results.size() == xs.size(), "a result per row");
+    for (size_t i{ 0 }; i < xs.size() && i < results.size(); i++) {
+        calculator.ParseLine("x = " + std::to_string(xs[i]), 0);
+        double value;
+        Check(calculator.TryEvaluateLine(4, value).Ok() && Same(value, results[i]), "batch row " + std::to_string(i) + " matches evaluating it on its own");
+    }
+    // a bound name overrides the variable
+    results = calculator.EvaluateBatch(3, { "a", "x" }, { { 1, 2, 3 }, { 10, 10, 10 } });
+    Check(results == std::vector<double>{ 10, 20, 30 }, "binding a defined variable");
+    bool thrown{ false };
+    try {
+        calculator.EvaluateBatch(3, { "a", "x" }, { { 1, 2, 3 }, { 10, 10 } });
+    } catch (std::runtime_error&) {
+        thrown = true;
+    }
+    Check(thrown, "columns of different lengths throw");
+    thrown = false;
+    try {
+        calculator.EvaluateBatch(3, { "a", "x" }, { { 1, 2, 3 } });
+    } catch (std::runtime_error&) {
+        thrown = true;
+    }
+    Check(thrown, "a name without a column throws");
+}
+
+// removed lines are reused for new ones, with nothing of the old line left in them
+static void TestReusedLines() {
+    Calculator calculator;
+    SetLines(calculator, { "f(x) = x * 2", "f(3)", "a = 4", "a + 1" });
+    double value;
+    Check(calculator.TryEvaluateLine(1, value).Ok() && value == 6, "f(3)");
+    std::set<const InputLine*> removed{ &calculator.GetLine(0), &calculator.GetLine(2) };
+    calculator.RemoveLine(2);
+    calculator.RemoveLine(0);
+    Check(calculator.TryEvaluateLine(0, value).code == ECUndefined, "f(3) once f is gone");
+    Check(calculator.TryEvaluateLine(1, value).code == ECUndefined, "a + 1 once a is gone");
+    calculator.AddLine(0);
+    calculator.AddLine(0);
+    Check(removed.count(&calculator.GetLine(0)) != 0 && removed.count(&calculator.GetLine(1)) != 0, "the new lines take the removed ones' memory");
+    Check(calculator.GetLine(0).type == InputLineType::Expression && calculator.GetLine(0).postfix.empty() && calculator.GetLine(0).cache == nullptr, "a reused line starts out empty");
+    calculator.ParseLine("a = 10", 0);
+    calculator.ParseLine("f(x) = x + a", 1);
+    Check(calculator.TryEvaluateLine(2, value).Ok() && value == 13, "f(3) with the new f");
+    Check(calculator.TryEvaluateLine(3, value).Ok() && value == 11, "a + 1 with the new a");
+}
+
+// repeated calls come from the cache, until the function or anything it reads changes
+static void TestCallCache() {
+    Calculator calculator;
+    SetLines(calculator, { "a = 2", "f(x) = x * a", "f(3) + f(3) + f(4)" });
+    double value;
+    Check(calculator.TryEvaluateLine(2, value).Ok() && value == 20, "f(3) + f(3) + f(4)");
+    CacheStats stats = calculator.GetCacheStats(1);
+    Check(stats.hits == 1 && stats.misses == 2 && stats.entries == 2, "one hit and two misses");
+    calculator.ParseLine("a = 5", 0);
+    Check(calculator.TryEvaluateLine(2, value).Ok() && value == 50, "a variable the function reads changed");
+    calculator.ParseLine("f(x) = x + a", 1);
+    Check(calculator.TryEvaluateLine(2, value).Ok() && value == 25, "the function changed");
+    // whole numbers used to all hash to the same slot
+    calculator.ParseLine("sum(f(k), k, 0, 99)", 2);
+    Check(calculator.TryEvaluateLine(2, value).Ok() && calculator.GetCacheStats(1).entries > 50, "whole number arguments spread over the slots");
+    calculator.SetCacheSize(0);
+    Check(calculator.TryEvaluateLine(2, value).Ok() && value == 5450 && calculator.GetCacheStats(1).entries == 0, "without a cache");
+}
+
+static std::string ReadFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void WriteFile(const std::string& path, const std::string& contents) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(contents.data(), contents.size());
+}
+
+// a loaded snapshot evaluates like the sheet it was saved from, and one that doesn't fit is turned down before it
+// touches the calculator
+static void TestSnapshots() {
+    const std::string path = "calculator-tests.snapshot";
+    std::vector<std::string> lines{ "a = 2", "f(x, y) = x * y + a", "b = f(a, 3) - 1", "", "c = d", "2 ^ b + sqrt(a)", "f(1, 2) / b" };
+    Calculator saved;
+    SetLines(saved, lines);
+    Check(saved.SaveSnapshot(path, lines), "saving a snapshot");
+    std::string contents = ReadFile(path);
+    auto sameResults = [&](Calculator& loaded) {
+        std::vector<LineResult> want = saved.RecalculateAll();
+        std::vector<LineResult> got = loaded.RecalculateAll();
+        bool same = want.size() == got.size();
+        for (size_t i{ 0 }; same && i < want.size(); i++) {
+            same = want[i].ok == got[i].ok && want[i].error == got[i].error && Same(want[i].value, got[i].value);
+        }
+        return same;
+    };
+    {
+        Calculator loaded;
+        Check(loaded.LoadSnapshot(path, lines) && sameResults(loaded), "a loaded snapshot evaluates like the sheet it came from");
+    }
+    {
+        std::vector<std::string> edited = lines;
+        edited[0] = "a = 3";
+        Calculator loaded;
+        Check(!loaded.LoadSnapshot(path, edited) && loaded.LineCount() == 0, "a snapshot of other text");
+    }
+    // the last line's references are the end of the file, and its last one is b
+    for (int bad : { -1, 1 << 30 }) {
+        std::string corrupted = contents;
+        std::memcpy(&corrupted[corrupted.size() - sizeof(int)], &bad, sizeof(int));
+        WriteFile(path, corrupted);
+        Calculator loaded;
+        Check(!loaded.LoadSnapshot(path, lines) && loaded.LineCount() == 0, "a reference to id " + std::to_string(bad));
+    }
+    for (size_t size : { contents.size() / 2, contents.size() - 1 }) {
+        WriteFile(path, contents.substr(0, size));
+        Calculator loaded;
+        Check(!loaded.LoadSnapshot(path, lines) && loaded.LineCount() == 0, "a snapshot cut off at " + std::to_string(size) + " bytes");
+    }
+    // whatever a single flipped byte does, loading either turns the file down or gives a sheet that evaluates
+    for (size_t i{ 0 }; i < contents.size(); i++) {
+        std::string corrupted = contents;
+        corrupted[i] = ~corrupted[i];
+        WriteFile(path, corrupted);
+        Calculator loaded;
+        if (loaded.LoadSnapshot(path, lines)) {
+            loaded.RecalculateAll();
+        } else {
+            Check(loaded.LineCount() == 0, "a turned down snapshot leaves no lines, byte " + std::to_string(i) + " flipped");
+        }
+    }
+    std::remove(path.c_str());
+}
+
+// a handle finds its line however many lines come and go around it, checked against a plain vector of handles
+static void TestLineHandles() {
+    Calculator calculator;
+    std::vector<int> handles{};
+    std::set<int> issued{};
+    std::mt19937 random{ 24 };
+    for (int step{ 0 }; step < 3000; step++) {
+        if (handles.empty() || random() % 3 != 0) {
+            int index = random() % (handles.size() + 1);
+            int handle = calculator.AddLine(index);
+            Check(issued.insert(handle).second, "handles aren't reused");
+            handles.insert(handles.begin() + index, handle);
+        } else {
+            int index = random() % handles.size();
+            int handle = handles[index];
+            calculator.RemoveLine(index);
+            handles.erase(handles.begin() + index);
+            bool thrown{ false };
+            try {
+                calculator.GetLineIndex(handle);
+            } catch (std::out_of_range&) {
+                thrown = true;
+            }
+            Check(thrown, "a removed line's handle throws");
+        }
+    }
+    Check(calculator.LineCount() == (int) handles.size(), "line count");
+    bool same{ true };
+    for (size_t i{ 0 }; i < handles.size(); i++) {
+        same = same && calculator.GetLineHandle(i) == handles[i] && calculator.GetLineIndex(handles[i]) == (int) i;
+    }
+    Check(same, "every handle and index agree with the model");
+    // the line a handle points to is the one its text went into
+    int middle = handles.size() / 2;
+    calculator.ParseLine("e = 7", middle);
+    calculator.AddLine(0);
+    calculator.RemoveLine(handles.size());
+    double value;
+    Check(calculator.TryEvaluateLine(calculator.GetLineIndex(handles[middle]), value).Ok() && value == 7, "a line found by its handle after lines moved");
+}
+
+// symbols are left out, two calculators hand out ids in the order they come across names
+static bool SamePostfix(const std::deque<PostfixItem>& a, const std::deque<PostfixItem>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i{ 0 }; i < a.size(); i++) {
+        if (a[i].type != b[i].type || !Same(a[i].value, b[i].value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// editing a line a piece at a time has to end up exactly where parsing the whole text does, failures included
+static void TestEdits() {
+    std::vector<std::string> lines{ "a = 2", "f(x) = x * a", "" };
+    Calculator edited;
+    SetLines(edited, lines);
+    std::string text{};
+    // mostly pieces that leave the line valid wherever they go in, so most edits evaluate
+    const std::vector<std::string> pieces{ "1", "7", "a", " + ", " * ", "/", "f(2)", "(a + 1)", "sin(a)", "2.5", "sum(k, k, 1, 3)", "b", "(", "x = " };
+    std::mt19937 random{ 25 };
+    for (int step{ 0 }; step < 2000; step++) {
+        size_t offset = random() % (text.size() + 1);
+        size_t removed = random() % 3 == 0 ? random() % (text.size() - offset + 1) : 0;
+        const std::string& inserted = removed != 0 && random() % 2 == 0 ? std::string{} : pieces[random() % pieces.size()];
+        text.replace(offset, removed, inserted);
+        CalcStatus got = edited.TryEditLine(2, offset, removed, inserted);
+        Calculator parsed;
+        SetLines(parsed, lines);
+        CalcStatus want = parsed.TryParseLine(text, 2);
+        const InputLine& a = edited.GetLine(2);
+        const InputLine& b = parsed.GetLine(2);
+        // the formatted line has the names, and the value for an expression
+        std::string expected{}, output{};
+        CalcStatus wantOutput = parsed.TryGetFormattedLine(2, expected);
+        CalcStatus gotOutput = edited.TryGetFormattedLine(2, output);
+        if (want.code != got.code || want.position != got.position || a.source != text || a.type != b.type || !SamePostfix(a.postfix, b.postfix) ||
+            wantOutput.code != gotOutput.code || expected != output) {
+            Check(false, "editing into \"" + text + "\" parses like the whole text");
+            return;
+        }
+        // start over every so often, short lines are where most of the edits happen
+        if (text.size() > 60) {
+            edited.ParseLine("", 2);
+            text.clear();
+        }
+    }
+}
+
+// batch failures come back as a status like every other Try function, with a code of their own
+static void TestBatchErrors() {
+    Calculator calculator;
+    SetLines(calculator, { "x = 0", "f(t) = t * x", "solve(f, 1, 1)", "sum(k * x, k, 1, 3)", "x + nothing", "x * 2", "y = 1", "x + y" });
+    calculator.ParseLine("z = 1", 6);
+    std::vector<double> results;
+    std::vector<double> xs{ 1, 2 };
+    try {
+        Check(calculator.TryEvaluateBatch(2, { "x" }, { xs }, results).code == ECBoundSolve, "solving a function that reads a column");
+        Check(calculator.TryEvaluateBatch(3, { "x" }, { xs }, results).code == ECBoundLoop, "a sum that reads a column");
+        Check(calculator.TryEvaluateBatch(4, { "x" }, { xs }, results).code == ECUnknownIdentifier, "a line that doesn't parse");
+        Check(calculator.TryEvaluateBatch(7, { "x" }, { xs }, results).code == ECUndefined, "a variable that's gone");
+        Check(calculator.TryEvaluateBatch(5, { "x", "y" }, { xs }, results).code == ECColumnCount, "a name without a column");
+        Check(calculator.TryEvaluateBatch(5, { "x", "y" }, { xs, { 1 } }, results).code == ECColumnLength, "ragged columns");
+        Check(calculator.TryEvaluateBatch(1, { "x" }, { xs }, results).code == ECFunctionLine, "a function line");
+        Check(calculator.TryEvaluateBatch(5, { "x" }, { xs }, results).Ok() && results == std::vector<double>{ 2, 4 }, "x * 2");
+    } catch (std::exception& e) {
+        Check(false, std::string("TryEvaluateBatch threw ") + e.what());
+    }
+}
+
+// folding works out constants with the same code evaluation would run, so nothing may change, not even which NaN comes out
+static void TestFolding() {
+    std::vector<std::string> lines{
+        "n = sqrt(0 - 1)",
+        "z = 0 * (0 - 1)",
+        "x = 3",
+        "n ^ 1", "n * 1", "1 * n", "n / 1", "n - 0", "n + 0",
+        "z + 0", "z - 0", "z * 1", "0 - z", "z ^ 1",
+        "x * (2 + 3) - 4 / 8 ^ 2", "sin(1) * cos(2) + tan(3) / log(4) - exp(5)", "(1 - 1) / 0", "0 / 0 * x",
+        "1 / 3 + x * (1 / 3) - 2 ^ 0.5", "sqrt(2) * sqrt(2) - 2 + x", "2x + 3(x - 1)", "x - 0.1 - 0.2 + 0.3",
+    };
+    Calculator folded;
+    Calculator unfolded;
+    unfolded.SetConstantFolding(false);
+    SetLines(folded, lines);
+    SetLines(unfolded, lines);
+    for (size_t i{ 0 }; i < lines.size(); i++) {
+        double expected{ 0 }, value{ 0 };
+        CalcStatus want = unfolded.TryEvaluateLine(i, expected);
+        CalcStatus got = folded.TryEvaluateLine(i, value);
+        Check(want.code == got.code && (!want.Ok() || SameBits(expected, value)), "folding \"" + lines[i] + "\" gives exactly what evaluating it does");
+    }
+    // folding fewer instructions than there were is the point of it
+    Check(folded.GetLine(14).bytecode.code.size() < unfolded.GetLine(14).bytecode.code.size(), "constants get folded");
+}
+
+int main() {
+    TestFunctionLine();
+    TestDirtyDependents();
+    TestEditedDependents();
+    TestIdentifiers();
+    TestBatch();
+    TestBatchErrors();
+    TestReusedLines();
+    TestCycleErrors();
+    TestRecalculateAll();
+    TestFormatting();
+    TestCallChain();
+    TestCallCache();
+    TestFolding();
+    TestClosureMatchesBytecode();
+    TestSumsAndIntegrals();
+    TestLiterals();
+#ifdef CALCULATOR_NUMERIC_TYPES
+    TestIntervals();
+#endif
+    TestSnapshots();
+    TestLineHandles();
+    TestEdits();
+    if (failures == 0) {
+        std::cout << "all passed" << std::endl;
+    }
+    return failures;
+}
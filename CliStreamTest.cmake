@@ -0,0 +1,29 @@
+# runs calculator-cli --stream over a generated input, with chunks small enough that lines get split between them,
+# and checks the output is every line's result in input order. CLI is the program, WORK_DIR where the files go
+set(block "a = 2\n1 + 2 * 3\n\nf(x) = x^2\nsqrt(16) / 0\nundefinedname + 1\n(1 + 2\nsum(k, k, 1, 4)\r\n2.5 * 4\n")
+set(results "a = 2.000000\n7.000000\n\nf(x) = x 2.000000 ^ \ninf\nError: Unknown identifier at index 0\nError: Mismatched parentheses\n10.000000\n10.000000\n")
+set(input "")
+set(expected "")
+foreach(i RANGE 199)
+    string(APPEND input "${block}")
+    string(APPEND expected "${results}")
+endforeach()
+# the last line has no newline
+string(APPEND input "x = 1 + 1")
+string(APPEND expected "x = 2.000000\n")
+file(WRITE "${WORK_DIR}/stream-input.txt" "${input}")
+file(WRITE "${WORK_DIR}/stream-expected.txt" "${expected}")
+
+foreach(options "--threads;1" "--threads;3;--chunk;7" "--threads;4;--chunk;1")
+    execute_process(COMMAND "${CLI}" --stream "${WORK_DIR}/stream-input.txt" --output "${WORK_DIR}/stream-output.txt" ${options}
+        RESULT_VARIABLE status)
+    string(REPLACE ";" " " options "${options}")
+    if(NOT status EQUAL 0)
+        message(FATAL_ERROR "calculator-cli --stream ${options} exited with ${status}")
+    endif()
+    execute_process(COMMAND "${CMAKE_COMMAND}" -E compare_files "${WORK_DIR}/stream-output.txt" "${WORK_DIR}/stream-expected.txt"
+        RESULT_VARIABLE different)
+    if(NOT different EQUAL 0)
+        message(FATAL_ERROR "calculator-cli --stream ${options} wrote something other than stream-expected.txt")
+    endif()
+endforeach()
@@ -0,0 +1,171 @@
+#include "InputList.h"
+
+#include <algorithm>
+
+const wxFont InputList::buttonFont = wxFontInfo(6).FaceName("Helvetica");
+static const wxCoord RowSpacing = 10;
+
+InputList::InputList(wxWindow* parent, AsyncEvaluator& evaluator)
+    : wxVScrolledWindow(parent, wxID_ANY), evaluator{ evaluator }, lines{}, rows{}, textHeight{ 0 }, buttonHeight{ 0 } {
+    // LayoutRows moves the controls itself, scrolling the window's contents as well would move them twice
+    EnablePhysicalScrolling(false);
+    // measured once on a throwaway row, every row is laid out the same
+    Row row = NewRow();
+    textHeight = row.text->GetBestSize().GetHeight();
+    buttonHeight = row.add->GetBestSize().GetHeight();
+    row.text->Destroy();
+    row.add->Destroy();
+    row.eval->Destroy();
+    row.remove->Destroy();
+    Bind(wxEVT_SIZE, &InputList::OnSize, this);
+}
+
+InputList::Row InputList::NewRow() {
+    Row row{};
+    row.text = new wxTextCtrl(this, wxID_ANY, "");
+    row.text->Bind(wxEVT_TEXT, &InputList::OnText, this);
+    row.add = new wxButton(this, wxID_ANY, "+", wxDefaultPosition, wxDefaultSize, wxBU_EXACTFIT);
+    row.add->SetFont(buttonFont);
+    row.add->Bind(wxEVT_BUTTON, &InputList::OnAdd, this);
+    row.eval = new wxButton(this, wxID_ANY, L"\U0001F441", wxDefaultPosition, wxDefaultSize, wxBU_EXACTFIT);
+    row.eval->SetFont(buttonFont);
+    row.remove = new wxButton(this, wxID_ANY, "X", wxDefaultPosition, wxDefaultSize, wxBU_EXACTFIT);
+    row.remove->SetFont(buttonFont);
+    row.remove->Bind(wxEVT_BUTTON, &InputList::OnRemove, this);
+    row.line = -1;
+    return row;
+}
+
+int InputList::LineCount() {
+    return lines.size();
+}
+
+wxCoord InputList::OnGetRowHeight(size_t row) const {
+    return textHeight + buttonHeight + RowSpacing;
+}
+
+bool InputList::DoScrollToUnit(size_t unit) {
+    bool scrolled = wxVScrolledWindow::DoScrollToUnit(unit);
+    LayoutRows();
+    return scrolled;
+}
+
+// hands the rows' controls to the lines on screen and puts them in place. Controls already showing a line that's
+// still on screen keep it, so the one being typed in doesn't change lines under the cursor
+void InputList::LayoutRows() {
+    wxSize client = GetClientSize();
+    wxCoord height = OnGetRowHeight(0);
+    size_t needed = client.GetHeight() / height + 2;
+    while (rows.size() < needed) {
+        rows.push_back(NewRow());
+        rows.back().text->Hide();
+        rows.back().add->Hide();
+        rows.back().eval->Hide();
+        rows.back().remove->Hide();
+    }
+    int first = GetVisibleRowsBegin();
+    int last = std::min<int>(first + needed, lines.size());
+    std::vector<char> shown(std::max(last - first, 0), false);
+    for (Row& row : rows) {
+        if (row.line >= first && row.line < last) {
+            shown[row.line - first] = true;
+        } else if (row.line != -1) {
+            // typing into a line that's gone off screen would end up in whatever line takes the control over
+            if (row.text->HasFocus()) {
+                SetFocus();
+            }
+            row.line = -1;
+        }
+    }
+    int next = first;
+    for (Row& row : rows) {
+        if (row.line == -1) {
+            while (next < last && shown[next - first]) {
+                next++;
+            }
+            if (next < last) {
+                row.line = next;
+                shown[next - first] = true;
+                // ChangeValue doesn't send a text event, nothing was edited
+                row.text->ChangeValue(lines[next]);
+            }
+        }
+        bool visible = row.line != -1;
+        row.text->Show(visible);
+        row.add->Show(visible);
+        row.eval->Show(visible);
+        row.remove->Show(visible && row.line != 0);
+        if (!visible) {
+            continue;
+        }
+        wxCoord y = (row.line - first) * height;
+        row.text->SetSize(0, y, client.GetWidth(), textHeight);
+        // right aligned under the text, in the order they're created
+        wxCoord x = client.GetWidth();
+        for (wxButton* button : { row.remove, row.eval, row.add }) {
+            if (button->IsShown()) {
+                wxCoord width = button->GetBestSize().GetWidth();
+                x -= width;
+                button->SetSize(x, y + textHeight, width, buttonHeight);
+            }
+        }
+    }
+}
+
+InputList::Row& InputList::RowFor(wxObject* control) {
+    return *std::find_if(rows.begin(), rows.end(), [control](const Row& row) {
+        return row.text == control || row.add == control || row.eval == control || row.remove == control;
+    });
+}
+
+void InputList::InsertLine(int index) {
+    lines.insert(lines.begin() + index, std::string{});
+    for (Row& row : rows) {
+        if (row.line >= index) {
+            row.line++;
+        }
+    }
+    evaluator.AddLine(index);
+    SetRowCount(lines.size());
+    LayoutRows();
+}
+
+void InputList::RemoveLine(int index) {
+    lines.erase(lines.begin() + index);
+    for (Row& row : rows) {
+        if (row.line == index) {
+            if (row.text->HasFocus()) {
+                SetFocus();
+            }
+            row.line = -1;
+        } else if (row.line > index) {
+            row.line--;
+        }
+    }
+    evaluator.RemoveLine(index);
+    SetRowCount(lines.size());
+    LayoutRows();
+}
+
+void InputList::OnSize(wxSizeEvent& event) {
+    event.Skip();
+    LayoutRows();
+}
+
+void InputList::OnText(wxCommandEvent& event) {
+    Row& row = RowFor(event.GetEventObject());
+    if (row.line == -1) {
+        return;
+    }
+    lines[row.line] = row.text->GetValue().ToStdString();
+    // parsed and evaluated on the worker, the result comes back as an OnEvaluated event
+    evaluator.Edit(row.line, lines[row.line]);
+}
+
+void InputList::OnAdd(wxCommandEvent& event) {
+    InsertLine(RowFor(event.GetEventObject()).line + 1);
+}
+
+void InputList::OnRemove(wxCommandEvent& event) {
+    RemoveLine(RowFor(event.GetEventObject()).line);
+}
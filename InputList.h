@@ -0,0 +1,51 @@
+#pragma once
+
+#include "wx/wxprec.h"
+#ifndef WX_PRECOMP
+#   include "wx/wx.h"
+#endif
+#include "wx/vscroll.h"
+
+#include <string>
+#include <vector>
+
+#include "AsyncEvaluator.h"
+
+// the worksheet's lines as a scrolled list that only has controls for the rows on screen. Every row is the same
+// height, so the visible ones are known straight from the scroll position, and scrolling hands the controls of rows
+// that went off screen to the ones coming on. Laying out only ever touches as many rows as fit in the window
+class InputList : public wxVScrolledWindow {
+private:
+    // the controls of one row on screen, line is the line they're showing or -1 while unused
+    struct Row {
+        wxTextCtrl* text;
+        wxButton* add;
+        wxButton* eval;
+        wxButton* remove;
+        int line;
+    };
+
+    AsyncEvaluator& evaluator;
+    std::vector<std::string> lines; // the text of every line, the controls only ever show some of it
+    std::vector<Row> rows;
+    wxCoord textHeight;
+    wxCoord buttonHeight;
+
+    static const wxFont buttonFont;
+
+    Row& RowFor(wxObject* control);
+    Row NewRow();
+    void LayoutRows();
+    void OnSize(wxSizeEvent& event);
+    void OnText(wxCommandEvent& event);
+    void OnAdd(wxCommandEvent& event);
+    void OnRemove(wxCommandEvent& event);
+
+public:
+    InputList(wxWindow* parent, AsyncEvaluator& evaluator);
+    int LineCount();
+    void InsertLine(int index);
+    void RemoveLine(int index);
+    virtual wxCoord OnGetRowHeight(size_t row) const;
+    virtual bool DoScrollToUnit(size_t unit);
+};
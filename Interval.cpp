@@ -0,0 +1,198 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "Interval.h"
+
+static const double Infinity = std::numeric_limits<double>::infinity();
+static const double NaN = std::numeric_limits<double>::quiet_NaN();
+static const double Pi = 3.14159265358979323846;
+static const double Exact = 9007199254740992.0; // 2^53, every whole number below it is a double, 2^53 + 1 already rounds to it
+static const double Slack = 1e-9; // in periods, so an extremum right at an end isn't missed to rounding
+
+static double Down(double x) {
+    return std::nextafter(x, -Infinity);
+}
+
+static double Up(double x) {
+    return std::nextafter(x, Infinity);
+}
+
+// from the lowest to the highest of values, widened by an ulp. 0 times infinity comes out as NaN, but wherever an end
+// is infinite it stands for numbers that only grow, so 0 is what the product was heading for
+static Interval Hull(double* values, int count) {
+    double low = Infinity, high = -Infinity;
+    for (int i{ 0 }; i < count; i++) {
+        double x = std::isnan(values[i]) ? 0 : values[i];
+        low = std::min(low, x);
+        high = std::max(high, x);
+    }
+    return Interval(Down(low), Up(high));
+}
+
+// whether offset plus some whole number of periods is between low and high. Errs towards yes, which only ever makes
+// the result wider
+static bool Reaches(double low, double high, double offset, double period) {
+    return std::floor((high - offset) / period + Slack) >= std::ceil((low - offset) / period - Slack);
+}
+
+Interval Interval::Entire() {
+    return Interval(-Infinity, Infinity);
+}
+
+Interval Interval::Around(double x) {
+    if (x == std::floor(x) && std::fabs(x) < Exact) {
+        return Interval(x);
+    }
+    return Interval(Down(x), Up(x));
+}
+
+bool Interval::IsNaN() const {
+    return std::isnan(low) || std::isnan(high);
+}
+
+double Primal(const Interval& x) {
+    return x.low == x.high ? x.low : NaN;
+}
+
+Interval operator+(const Interval& a, const Interval& b) {
+    return Interval(Down(a.low + b.low), Up(a.high + b.high));
+}
+
+Interval operator-(const Interval& a, const Interval& b) {
+    return Interval(Down(a.low - b.high), Up(a.high - b.low));
+}
+
+Interval operator-(const Interval& a) {
+    // exact, nothing to round
+    return Interval(-a.high, -a.low);
+}
+
+Interval operator*(const Interval& a, const Interval& b) {
+    if (a.IsNaN() || b.IsNaN()) {
+        return Interval(NaN);
+    }
+    double products[4] = { a.low * b.low, a.low * b.high, a.high * b.low, a.high * b.high };
+    return Hull(products, 4);
+}
+
+Interval operator/(const Interval& a, const Interval& b) {
+    if (a.IsNaN() || b.IsNaN()) {
+        return Interval(NaN);
+    }
+    // anything over a range that takes in 0, 0 itself included, could be anything
+    if (b.low <= 0 && b.high >= 0) {
+        return Interval::Entire();
+    }
+    double quotients[4] = { a.low / b.low, a.low / b.high, a.high / b.low, a.high / b.high };
+    return Hull(quotients, 4);
+}
+
+Interval sqrt(const Interval& x) {
+    if (x.IsNaN() || x.high < 0) {
+        return Interval(NaN);
+    }
+    return Interval(std::max(0.0, Down(std::sqrt(std::max(x.low, 0.0)))), Up(std::sqrt(x.high)));
+}
+
+// sin and cos climb from one extreme to the other in half a period, so in between the ends only decide the result
+// when no extreme is reached
+static Interval Periodic(const Interval& x, double (*f)(double), double peak, double trough) {
+    if (x.IsNaN()) {
+        return Interval(NaN);
+    }
+    if (!std::isfinite(x.low) || !std::isfinite(x.high) || x.high - x.low >= 2 * Pi) {
+        return Interval(-1, 1);
+    }
+    double ends[2] = { f(x.low), f(x.high) };
+    Interval result = Hull(ends, 2);
+    result.low = Reaches(x.low, x.high, trough, 2 * Pi) ? -1 : std::max(result.low, -1.0);
+    result.high = Reaches(x.low, x.high, peak, 2 * Pi) ? 1 : std::min(result.high, 1.0);
+    return result;
+}
+
+Interval sin(const Interval& x) {
+    return Periodic(x, [](double y) { return std::sin(y); }, Pi / 2, -Pi / 2);
+}
+
+Interval cos(const Interval& x) {
+    return Periodic(x, [](double y) { return std::cos(y); }, 0, Pi);
+}
+
+Interval tan(const Interval& x) {
+    if (x.IsNaN()) {
+        return Interval(NaN);
+    }
+    // rising everywhere except across the poles, where it goes through infinity
+    if (!std::isfinite(x.low) || !std::isfinite(x.high) || Reaches(x.low, x.high, Pi / 2, Pi)) {
+        return Interval::Entire();
+    }
+    return Interval(Down(std::tan(x.low)), Up(std::tan(x.high)));
+}
+
+Interval log(const Interval& x) {
+    if (x.IsNaN() || x.high < 0) {
+        return Interval(NaN);
+    }
+    return Interval(Down(std::log(std::max(x.low, 0.0))), Up(std::log(x.high)));
+}
+
+Interval exp(const Interval& x) {
+    if (x.IsNaN()) {
+        return Interval(NaN);
+    }
+    return Interval(std::max(0.0, Down(std::exp(x.low))), Up(std::exp(x.high)));
+}
+
+// a whole power, which negative numbers have too
+static Interval WholePower(const Interval& x, double n) {
+    if (n == 0) {
+        return Interval(1);
+    }
+    if (n < 0) {
+        return Interval(1) / WholePower(x, -n);
+    }
+    double low = std::pow(x.low, n), high = std::pow(x.high, n);
+    if (std::fmod(n, 2) == 1 || x.low >= 0) {
+        return Interval(Down(low), Up(high));
+    }
+    if (x.high <= 0) {
+        return Interval(Down(high), Up(low));
+    }
+    // even powers bottom out at 0 in between
+    return Interval(0, Up(std::max(low, high)));
+}
+
+Interval pow(const Interval& x, const Interval& y) {
+    if (x.IsNaN() || y.IsNaN()) {
+        return Interval(NaN);
+    }
+    if (y.low == y.high && y.low == std::floor(y.low) && std::fabs(y.low) <= Exact) {
+        return WholePower(x, y.low);
+    }
+    // anything else only has the positive part of x to go on
+    if (x.high < 0) {
+        return Interval(NaN);
+    }
+    return exp(y * log(Interval(std::max(x.low, 0.0), x.high)));
+}
+
+Interval fmin(const Interval& x, const Interval& y) {
+    if (x.IsNaN()) {
+        return y;
+    }
+    if (y.IsNaN()) {
+        return x;
+    }
+    return Interval(std::min(x.low, y.low), std::min(x.high, y.high));
+}
+
+Interval fmax(const Interval& x, const Interval& y) {
+    if (x.IsNaN()) {
+        return y;
+    }
+    if (y.IsNaN()) {
+        return x;
+    }
+    return Interval(std::max(x.low, y.low), std::max(x.high, y.high));
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+// a range the exact result is guaranteed to be in. Every operation rounds the ends outwards, by an ulp, which covers
+// the rounding of the arithmetic and of the maths library as long as that is accurate to an ulp. However many steps a
+// calculation takes, the exact answer stays inside. NaN ends mean there's no result at all
+struct Interval {
+    double low;
+    double high;
+
+    Interval(double x = 0) : low{ x }, high{ x } {
+    }
+
+    Interval(double low, double high) : low{ low }, high{ high } {
+    }
+
+    // every number, for results nothing more is known about
+    static Interval Entire();
+    // x and the doubles either side of it, for a number that was rounded on its way to being x. Whole numbers are
+    // taken as exact
+    static Interval Around(double x);
+
+    bool IsNaN() const;
+
+    friend Interval operator+(const Interval& a, const Interval& b);
+    friend Interval operator-(const Interval& a, const Interval& b);
+    friend Interval operator-(const Interval& a);
+    friend Interval operator*(const Interval& a, const Interval& b);
+    friend Interval operator/(const Interval& a, const Interval& b);
+};
+
+// the number an interval stands for where only one will do, NaN unless it's down to a single one
+double Primal(const Interval& x);
+
+// the std versions for intervals, found by overload resolution wherever the std ones are brought in with using
+Interval sqrt(const Interval& x);
+Interval sin(const Interval& x);
+Interval cos(const Interval& x);
+Interval tan(const Interval& x);
+Interval log(const Interval& x);
+Interval exp(const Interval& x);
+Interval pow(const Interval& x, const Interval& y);
+// like std::fmin and std::fmax, a NaN loses to a number
+Interval fmin(const Interval& x, const Interval& y);
+Interval fmax(const Interval& x, const Interval& y);
@@ -0,0 +1,142 @@
+#include <stdexcept>
+
+#include "LineOrder.h"
+
+const int LineOrder::None;
+
+int LineOrder::Size(int node) const {
+    return node == None ? 0 : nodes[node].size;
+}
+
+// fixes node's size and its children's parents after they changed
+void LineOrder::Update(int node) {
+    Node& n = nodes[node];
+    n.size = Size(n.left) + Size(n.right) + 1;
+    if (n.left != None) {
+        nodes[n.left].parent = node;
+    }
+    if (n.right != None) {
+        nodes[n.right].parent = node;
+    }
+}
+
+// the first count lines of node's subtree end up in left, the rest in right
+void LineOrder::Split(int node, int count, int& left, int& right) {
+    if (node == None) {
+        left = right = None;
+        return;
+    }
+    Node& n = nodes[node];
+    if (Size(n.left) < count) {
+        Split(n.right, count - Size(n.left) - 1, n.right, right);
+        left = node;
+    } else {
+        Split(n.left, count, left, n.left);
+        right = node;
+    }
+    Update(node);
+}
+
+// every line of left followed by every line of right, returns the new root
+int LineOrder::Merge(int left, int right) {
+    if (left == None || right == None) {
+        return left == None ? right : left;
+    }
+    if (nodes[left].priority > nodes[right].priority) {
+        nodes[left].right = Merge(nodes[left].right, right);
+        Update(left);
+        return left;
+    }
+    nodes[right].left = Merge(left, nodes[right].left);
+    Update(right);
+    return right;
+}
+
+int LineOrder::Insert(int position) {
+    if (position < 0 || position > Size()) {
+        throw std::out_of_range("line position out of range");
+    }
+    // xorshift, only the spread matters
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    int handle = nodes.size();
+    nodes.push_back(Node{ None, None, None, seed, 1 });
+    int left, right;
+    Split(root, position, left, right);
+    root = Merge(Merge(left, handle), right);
+    nodes[root].parent = None;
+    return handle;
+}
+
+void LineOrder::Remove(int handle) {
+    int position = Position(handle);
+    int left, middle, right;
+    Split(root, position, left, middle);
+    Split(middle, 1, middle, right);
+    root = Merge(left, right);
+    if (root != None) {
+        nodes[root].parent = None;
+    }
+    nodes[handle] = Node{ None, None, None, 0, 0 };
+}
+
+int LineOrder::Position(int handle) const {
+    if (handle < 0 || (size_t) handle >= nodes.size() || nodes[handle].size == 0) {
+        throw std::out_of_range("not a current line");
+    }
+    int position = Size(nodes[handle].left);
+    for (int node{ handle }; nodes[node].parent != None; node = nodes[node].parent) {
+        const Node& parent = nodes[nodes[node].parent];
+        if (parent.right == node) {
+            position += Size(parent.left) + 1;
+        }
+    }
+    return position;
+}
+
+int LineOrder::At(int position) const {
+    if (position < 0 || position >= Size()) {
+        throw std::out_of_range("line position out of range");
+    }
+    int node = root;
+    while (true) {
+        int leftSize = Size(nodes[node].left);
+        if (position == leftSize) {
+            return node;
+        }
+        if (position < leftSize) {
+            node = nodes[node].left;
+        } else {
+            position -= leftSize + 1;
+            node = nodes[node].right;
+        }
+    }
+}
+
+int LineOrder::Size() const {
+    return Size(root);
+}
+
+int LineOrder::HandleLimit() const {
+    return nodes.size();
+}
+
+std::vector<int> LineOrder::Handles() const {
+    std::vector<int> handles{};
+    handles.reserve(Size());
+    // in order without recursion, down the left spines
+    std::vector<int> pending{};
+    int node = root;
+    while (node != None || !pending.empty()) {
+        while (node != None) {
+            pending.push_back(node);
+            node = nodes[node].left;
+        }
+        node = pending.back();
+        pending.pop_back();
+        handles.push_back(node);
+        node = nodes[node].right;
+    }
+    return handles;
+}
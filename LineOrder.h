@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// the order of the lines, as a treap keyed by position rather than by value. Lines are known by handles, small dense
+// ids that stay the same however the lines around them move and are never reused. Every node keeps the size of its
+// subtree and its parent, so a handle's position is the sizes to its left on the way up, the handle at a position is
+// found on the way down, and inserting or removing anywhere splits and merges along one path. All O(log n)
+class LineOrder {
+private:
+    struct Node {
+        int left;
+        int right;
+        int parent;
+        uint32_t priority; // heap ordered, random so the tree stays balanced whatever order lines come in
+        int size; // of the subtree, 0 once removed
+    };
+
+    std::vector<Node> nodes; // by handle
+    int root{ None };
+    uint32_t seed{ 0x9E3779B9u };
+
+    int Size(int node) const;
+    void Update(int node);
+    void Split(int node, int count, int& left, int& right);
+    int Merge(int left, int right);
+
+public:
+    static const int None = -1;
+
+    // puts a new line at position and returns its handle
+    int Insert(int position);
+    void Remove(int handle);
+    // both throw std::out_of_range for anything that isn't a current line
+    int Position(int handle) const;
+    int At(int position) const;
+    int Size() const;
+    // one past the biggest handle handed out so far, for arrays indexed by handle
+    int HandleLimit() const;
+    // every handle, in order
+    std::vector<int> Handles() const;
+};
@@ -0,0 +1,377 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "Solver.h"
+
+static const double Epsilon = std::numeric_limits<double>::epsilon();
+static const int NewtonIterations = 50;
+static const int NewtonHalvings = 30;
+static const double NewtonTolerance = 1e-14; // relative size of the last step once converged
+static const int BracketSteps = 80; // the bracket grows 1.6 times per step, so it ends up around 1e14 times the first step
+static const int BrentIterations = 200;
+static const double Golden = 1.618034;
+static const double GoldenSection = 0.381966; // 2 - Golden
+static const double IntegralTolerance = 1e-10; // relative to the integral
+static const double MagnitudeTolerance = 1e-12; // relative to the integral of |f|, for integrals that cancel out to about 0
+
+// nodes of the 15 point Kronrod rule on [-1, 1], from the outside in. Every other one is also a node of the 7 point
+// Gauss rule, whose weights are gaussWeights
+static const double kronrodNodes[8] = {
+    0.991455371120812639206854697526329, 0.949107912342758524526189684047851, 0.864864423359769072789712788640926,
+    0.741531185599394439863864773280788, 0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245, 0
+};
+static const double kronrodWeights[8] = {
+    0.022935322010529224963732008058970, 0.063092092629978553290700663189204, 0.104790010322250183839876322541518,
+    0.140653259715525918745189590510238, 0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649, 0.209482141084727828012999174891714
+};
+static const double gaussWeights[4] = {
+    0.129484966168869693270611432679082, 0.279705391489276667901467771423780, 0.381830050505118944950369775488975,
+    0.417959183673469387755102040816327
+};
+
+// the first step of a search around guess, relative to its size so far from 0 it isn't lost in rounding
+static double FirstStep(double guess) {
+    return 0.01 * std::max(1.0, std::fabs(guess));
+}
+
+static bool Opposite(double a, double b) {
+    return (a < 0 && b > 0) || (a > 0 && b < 0);
+}
+
+SolverOutcome NewtonRoot(const SolverSlope& f, double target, double guess, double& root) {
+    double x = guess;
+    double value, slope;
+    if (!f(x, value, slope)) {
+        return SOAborted;
+    }
+    for (int i{ 0 }; i < NewtonIterations; i++) {
+        double residual = value - target;
+        if (residual == 0) {
+            root = x;
+            return SOFound;
+        }
+        if (!std::isfinite(residual) || !std::isfinite(slope) || slope == 0) {
+            return SONotFound;
+        }
+        double step = residual / slope;
+        double next;
+        for (int halvings{ 0 }; ; halvings++) {
+            next = x - step;
+            if (!f(next, value, slope)) {
+                return SOAborted;
+            }
+            if (std::isfinite(value) || halvings == NewtonHalvings) {
+                break;
+            }
+            step /= 2;
+        }
+        if (std::fabs(next - x) <= NewtonTolerance * std::max(1.0, std::fabs(next))) {
+            root = next;
+            return std::isfinite(value) ? SOFound : SONotFound;
+        }
+        x = next;
+    }
+    return SONotFound;
+}
+
+SolverOutcome BrentRoot(const SolverFunction& f, double target, double guess, double& root) {
+    auto g = [&](double x, double& y) {
+        if (!f(x, y)) {
+            return false;
+        }
+        y -= target;
+        return true;
+    };
+    double center;
+    if (!g(guess, center)) {
+        return SOAborted;
+    }
+    if (center == 0) {
+        root = guess;
+        return SOFound;
+    }
+    // the outermost points on either side where g could be evaluated, each side only starts once it has one
+    bool haveLow = std::isfinite(center);
+    bool haveHigh = haveLow;
+    double low = guess, lowValue = center, high = guess, highValue = center;
+    double a{ 0 }, b{ 0 }, fa{ 0 }, fb{ 0 };
+    bool bracketed{ false };
+    double step = FirstStep(guess);
+    for (int i{ 0 }; i < BracketSteps && !bracketed; i++, step *= 1.6) {
+        double x = guess - step;
+        double value;
+        if (!g(x, value)) {
+            return SOAborted;
+        }
+        if (std::isfinite(value)) {
+            if (haveLow && Opposite(value, lowValue)) {
+                a = x, fa = value, b = low, fb = lowValue;
+                bracketed = true;
+                break;
+            }
+            low = x, lowValue = value, haveLow = true;
+        }
+        x = guess + step;
+        if (!g(x, value)) {
+            return SOAborted;
+        }
+        if (std::isfinite(value)) {
+            if (haveHigh && Opposite(value, highValue)) {
+                a = high, fa = highValue, b = x, fb = value;
+                bracketed = true;
+                break;
+            }
+            high = x, highValue = value, haveHigh = true;
+        }
+        // with nothing defined at the guess the two sides only meet through each other
+        if (!std::isfinite(center) && haveLow && haveHigh && Opposite(lowValue, highValue)) {
+            a = low, fa = lowValue, b = high, fb = highValue;
+            bracketed = true;
+        }
+    }
+    if (!bracketed) {
+        return SONotFound;
+    }
+    if (fa == 0 || fb == 0) {
+        root = fa == 0 ? a : b;
+        return SOFound;
+    }
+    // Brent's method: inverse quadratic or secant steps while they behave, bisection when they don't.
+    // b is the best guess so far and the root always stays between b and c
+    double c = b, fc = fb;
+    double d{ 0 }, e{ 0 };
+    for (int i{ 0 }; i < BrentIterations; i++) {
+        if (!Opposite(fb, fc)) {
+            c = a, fc = fa;
+            e = d = b - a;
+        }
+        if (std::fabs(fc) < std::fabs(fb)) {
+            a = b, b = c, c = a;
+            fa = fb, fb = fc, fc = fa;
+        }
+        double tolerance = 2 * Epsilon * std::fabs(b) + std::numeric_limits<double>::min();
+        double middle = 0.5 * (c - b);
+        if (std::fabs(middle) <= tolerance || fb == 0) {
+            break;
+        }
+        if (std::fabs(e) >= tolerance && std::fabs(fa) > std::fabs(fb)) {
+            double s = fb / fa;
+            double p, q;
+            if (a == c) {
+                p = 2 * middle * s;
+                q = 1 - s;
+            } else {
+                double r = fb / fc;
+                q = fa / fc;
+                p = s * (2 * middle * q * (q - r) - (b - a) * (r - 1));
+                q = (q - 1) * (r - 1) * (s - 1);
+            }
+            if (p > 0) {
+                q = -q;
+            }
+            p = std::fabs(p);
+            if (2 * p < std::min(3 * middle * q - std::fabs(tolerance * q), std::fabs(e * q))) {
+                e = d;
+                d = p / q;
+            } else {
+                d = e = middle;
+            }
+        } else {
+            d = e = middle;
+        }
+        a = b, fa = fb;
+        b += std::fabs(d) > tolerance ? d : std::copysign(tolerance, middle);
+        if (!g(b, fb)) {
+            return SOAborted;
+        }
+        if (!std::isfinite(fb)) {
+            return SONotFound;
+        }
+    }
+    root = b;
+    return SOFound;
+}
+
+SolverOutcome BrentMinimum(const SolverFunction& f, double guess, double& minimum) {
+    // golden steps downhill until the middle of three points is below both ends
+    double a = guess, b = guess + FirstStep(guess);
+    double fa, fb, fc;
+    if (!f(a, fa) || !f(b, fb)) {
+        return SOAborted;
+    }
+    if (!std::isfinite(fa) || !std::isfinite(fb)) {
+        return SONotFound;
+    }
+    if (fb > fa) {
+        std::swap(a, b);
+        std::swap(fa, fb);
+    }
+    double c = b + Golden * (b - a);
+    if (!f(c, fc)) {
+        return SOAborted;
+    }
+    for (int i{ 0 }; fc < fb; i++) {
+        if (i == BracketSteps || !std::isfinite(fc)) {
+            return SONotFound;
+        }
+        a = b, fa = fb;
+        b = c, fb = fc;
+        c = b + Golden * (b - a);
+        if (!f(c, fc)) {
+            return SOAborted;
+        }
+    }
+    if (!std::isfinite(fc)) {
+        return SONotFound;
+    }
+    // Brent's method: parabolic steps through the three best points while they behave, golden section when they
+    // don't. x is the lowest point so far, w the one before it and v the one before that
+    double low = std::min(a, c), high = std::max(a, c);
+    double x = b, w = b, v = b;
+    double fx = fb, fw = fb, fv = fb;
+    double d{ 0 }, e{ 0 };
+    const double tolerance = std::sqrt(Epsilon); // minima can't be located any closer than that
+    for (int i{ 0 }; i < BrentIterations; i++) {
+        double middle = 0.5 * (low + high);
+        double tolerance1 = tolerance * std::fabs(x) + 1e-3 * Epsilon;
+        double tolerance2 = 2 * tolerance1;
+        if (std::fabs(x - middle) <= tolerance2 - 0.5 * (high - low)) {
+            break;
+        }
+        bool golden{ true };
+        if (std::fabs(e) > tolerance1) {
+            double r = (x - w) * (fx - fv);
+            double q = (x - v) * (fx - fw);
+            double p = (x - v) * q - (x - w) * r;
+            q = 2 * (q - r);
+            if (q > 0) {
+                p = -p;
+            }
+            q = std::fabs(q);
+            double last = e;
+            e = d;
+            if (std::fabs(p) < std::fabs(0.5 * q * last) && p > q * (low - x) && p < q * (high - x)) {
+                d = p / q;
+                double u = x + d;
+                if (u - low < tolerance2 || high - u < tolerance2) {
+                    d = std::copysign(tolerance1, middle - x);
+                }
+                golden = false;
+            }
+        }
+        if (golden) {
+            e = x >= middle ? low - x : high - x;
+            d = GoldenSection * e;
+        }
+        double u = std::fabs(d) >= tolerance1 ? x + d : x + std::copysign(tolerance1, d);
+        double fu;
+        if (!f(u, fu)) {
+            return SOAborted;
+        }
+        if (fu <= fx) {
+            (u >= x ? low : high) = x;
+            v = w, fv = fw;
+            w = x, fw = fx;
+            x = u, fx = fu;
+        } else {
+            (u < x ? low : high) = u;
+            if (fu <= fw || w == x) {
+                v = w, fv = fw;
+                w = u, fw = fu;
+            } else if (fu <= fv || v == x || v == w) {
+                v = u, fv = fu;
+            }
+        }
+    }
+    minimum = x;
+    return SOFound;
+}
+
+struct Subinterval {
+    double a;
+    double b;
+    double estimate;
+    double error; // how far the Gauss estimate is from the Kronrod one
+    double magnitude; // estimate of the integral of |f|
+};
+
+static bool GaussKronrod(const SolverFunction& f, Subinterval& interval) {
+    double center = 0.5 * (interval.a + interval.b);
+    double half = 0.5 * (interval.b - interval.a);
+    double fc;
+    if (!f(center, fc)) {
+        return false;
+    }
+    double kronrod = fc * kronrodWeights[7];
+    double gauss = fc * gaussWeights[3];
+    double magnitude = std::fabs(kronrod);
+    for (int j{ 0 }; j < 7; j++) {
+        double offset = half * kronrodNodes[j];
+        double f1, f2;
+        if (!f(center - offset, f1) || !f(center + offset, f2)) {
+            return false;
+        }
+        kronrod += kronrodWeights[j] * (f1 + f2);
+        magnitude += kronrodWeights[j] * (std::fabs(f1) + std::fabs(f2));
+        if (j % 2 == 1) {
+            gauss += gaussWeights[j / 2] * (f1 + f2);
+        }
+    }
+    interval.estimate = kronrod * half;
+    interval.error = std::fabs((kronrod - gauss) * half);
+    interval.magnitude = magnitude * std::fabs(half);
+    return true;
+}
+
+SolverOutcome AdaptiveIntegral(const SolverFunction& f, double a, double b, size_t limit, double& integral) {
+    // a heap on the error, so the worst interval is always the next one split
+    auto better = [](const Subinterval& x, const Subinterval& y) { return x.error < y.error; };
+    std::vector<Subinterval> intervals{ Subinterval{ a, b, 0, 0, 0 } };
+    if (!GaussKronrod(f, intervals[0])) {
+        return SOAborted;
+    }
+    double total = intervals[0].estimate;
+    double error = intervals[0].error;
+    double magnitude = intervals[0].magnitude;
+    SolverOutcome outcome{ SOFound };
+    // a NaN anywhere fails the comparison and ends up in the result
+    while (error > std::max(IntegralTolerance * std::fabs(total), MagnitudeTolerance * magnitude)) {
+        if (intervals.size() >= limit) {
+            outcome = SONotFound;
+            break;
+        }
+        std::pop_heap(intervals.begin(), intervals.end(), better);
+        Subinterval worst = intervals.back();
+        intervals.pop_back();
+        double middle = 0.5 * (worst.a + worst.b);
+        // nothing left to split
+        if (middle == worst.a || middle == worst.b) {
+            intervals.push_back(worst);
+            outcome = SONotFound;
+            break;
+        }
+        Subinterval left{ worst.a, middle, 0, 0, 0 };
+        Subinterval right{ middle, worst.b, 0, 0, 0 };
+        if (!GaussKronrod(f, left) || !GaussKronrod(f, right)) {
+            return SOAborted;
+        }
+        total += left.estimate + right.estimate - worst.estimate;
+        error += left.error + right.error - worst.error;
+        magnitude += left.magnitude + right.magnitude - worst.magnitude;
+        intervals.push_back(left);
+        std::push_heap(intervals.begin(), intervals.end(), better);
+        intervals.push_back(right);
+        std::push_heap(intervals.begin(), intervals.end(), better);
+    }
+    // added up again from scratch, the running total picked up rounding with every split
+    integral = 0;
+    for (const Subinterval& interval : intervals) {
+        integral += interval.estimate;
+    }
+    return outcome;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+
+// a value together with its derivative with respect to one variable. Arithmetic on duals carries the derivative along
+// by the chain rule, so running an expression on them gives its exact slope in the same pass. Nesting them,
+// Dual<Dual<double>>, gives the second derivative as well
+template<class T>
+struct Dual {
+    T value;
+    T slope;
+
+    Dual(double constant = 0) : value(constant), slope(0) {
+    }
+
+    Dual(T value, T slope) : value{ value }, slope{ slope } {
+    }
+
+    friend Dual operator+(const Dual& a, const Dual& b) {
+        return Dual(a.value + b.value, a.slope + b.slope);
+    }
+
+    friend Dual operator-(const Dual& a, const Dual& b) {
+        return Dual(a.value - b.value, a.slope - b.slope);
+    }
+
+    friend Dual operator-(const Dual& a) {
+        return Dual(0 - a.value, 0 - a.slope);
+    }
+
+    friend Dual operator*(const Dual& a, const Dual& b) {
+        return Dual(a.value * b.value, a.slope * b.value + a.value * b.slope);
+    }
+
+    friend Dual operator/(const Dual& a, const Dual& b) {
+        return Dual(a.value / b.value, (a.slope * b.value - a.value * b.slope) / (b.value * b.value));
+    }
+};
+
+template<class T>
+struct IsDual : std::false_type {
+};
+
+template<class T>
+struct IsDual<Dual<T>> : std::true_type {
+};
+
+// the plain number inside however many layers of duals
+inline double Primal(double x) {
+    return x;
+}
+
+template<class T>
+double Primal(const Dual<T>& x) {
+    return Primal(x.value);
+}
+
+inline bool IsZero(double x) {
+    return x == 0;
+}
+
+template<class T>
+bool IsZero(const Dual<T>& x) {
+    return IsZero(x.value) && IsZero(x.slope);
+}
+
+// the std versions for duals, found by overload resolution wherever the std ones are brought in with using
+
+template<class T>
+Dual<T> sqrt(const Dual<T>& x) {
+    using std::sqrt;
+    T root = sqrt(x.value);
+    return Dual<T>(root, x.slope / (root * 2));
+}
+
+template<class T>
+Dual<T> sin(const Dual<T>& x) {
+    using std::sin;
+    using std::cos;
+    return Dual<T>(sin(x.value), x.slope * cos(x.value));
+}
+
+template<class T>
+Dual<T> cos(const Dual<T>& x) {
+    using std::sin;
+    using std::cos;
+    return Dual<T>(cos(x.value), 0 - x.slope * sin(x.value));
+}
+
+template<class T>
+Dual<T> tan(const Dual<T>& x) {
+    using std::tan;
+    T t = tan(x.value);
+    return Dual<T>(t, x.slope * (t * t + 1));
+}
+
+template<class T>
+Dual<T> log(const Dual<T>& x) {
+    using std::log;
+    return Dual<T>(log(x.value), x.slope / x.value);
+}
+
+template<class T>
+Dual<T> exp(const Dual<T>& x) {
+    using std::exp;
+    T e = exp(x.value);
+    return Dual<T>(e, x.slope * e);
+}
+
+template<class T>
+Dual<T> pow(const Dual<T>& x, const Dual<T>& y) {
+    using std::pow;
+    using std::log;
+    T value = pow(x.value, y.value);
+    T slope = y.value * pow(x.value, y.value - 1) * x.slope;
+    // only a varying exponent needs the log, which a negative base doesn't have
+    if (!IsZero(y.slope)) {
+        slope = slope + value * log(x.value) * y.slope;
+    }
+    return Dual<T>(value, slope);
+}
+
+// like std::fmin and std::fmax, a NaN loses to a number
+template<class T>
+Dual<T> fmin(const Dual<T>& x, const Dual<T>& y) {
+    if (std::isnan(Primal(x))) {
+        return y;
+    }
+    if (std::isnan(Primal(y))) {
+        return x;
+    }
+    return Primal(y) < Primal(x) ? y : x;
+}
+
+template<class T>
+Dual<T> fmax(const Dual<T>& x, const Dual<T>& y) {
+    if (std::isnan(Primal(x))) {
+        return y;
+    }
+    if (std::isnan(Primal(y))) {
+        return x;
+    }
+    return Primal(y) > Primal(x) ? y : x;
+}
+
+enum SolverOutcome {
+    SOFound,
+    SONotFound,
+    SOAborted // a callback returned false
+};
+
+// the function being solved at x. Returning false stops the solver
+typedef std::function<bool(double x, double& value)> SolverFunction;
+// the same, with the slope at x as well
+typedef std::function<bool(double x, double& value, double& slope)> SolverSlope;
+
+// Newton's method for f(x) = target, starting at guess. Steps that land somewhere f can't be evaluated are halved,
+// anything that stops converging gives up so a bracketing method can take over
+SolverOutcome NewtonRoot(const SolverSlope& f, double target, double guess, double& root);
+// searches outwards from guess for a sign change of f(x) - target, then narrows it down with Brent's method
+SolverOutcome BrentRoot(const SolverFunction& f, double target, double guess, double& root);
+// walks downhill from guess until a minimum is bracketed, then narrows it down with Brent's method
+SolverOutcome BrentMinimum(const SolverFunction& f, double guess, double& minimum);
+// integrates f from a to b with 15 point Gauss-Kronrod rules, splitting whichever interval has the biggest error
+// estimate until the total is within tolerance or there are limit intervals. SONotFound still leaves the best
+// estimate in integral
+SolverOutcome AdaptiveIntegral(const SolverFunction& f, double a, double b, size_t limit, double& integral);
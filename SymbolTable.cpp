@@ -0,0 +1,27 @@
+#include "SymbolTable.h"
+
+const int SymbolTable::None;
+
+int SymbolTable::Intern(const std::string& name) {
+    auto it = ids.find(name);
+    if (it != ids.end()) {
+        return it->second;
+    }
+    int symbol = names.size();
+    ids.emplace(name, symbol);
+    names.push_back(name);
+    return symbol;
+}
+
+int SymbolTable::Find(const std::string& name) const {
+    auto it = ids.find(name);
+    return it == ids.end() ? None : it->second;
+}
+
+const std::string& SymbolTable::Name(int symbol) const {
+    return names.at(symbol);
+}
+
+size_t SymbolTable::Size() const {
+    return names.size();
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// gives every identifier a small dense id, so everything past tokenizing can index arrays instead of comparing strings.
+// ids are never reused, a name keeps its id for as long as the table lives
+class SymbolTable {
+private:
+    std::unordered_map<std::string, int> ids;
+    std::vector<std::string> names;
+
+public:
+    static const int None = -1;
+
+    int Intern(const std::string& name);
+    int Find(const std::string& name) const;
+    const std::string& Name(int symbol) const;
+    size_t Size() const;
+};
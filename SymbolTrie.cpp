@@ -0,0 +1,58 @@
+#include "SymbolTrie.h"
+
+int SymbolTrie::Child(int node, char c) const {
+    for (const std::pair<char, int>& child : nodes[node].children) {
+        if (child.first == c) {
+            return child.second;
+        }
+    }
+    return -1;
+}
+
+void SymbolTrie::Insert(const std::string& name, SymbolKind kind, int symbol) {
+    int node{ 0 };
+    for (char c : name) {
+        int next = Child(node, c);
+        if (next == -1) {
+            next = nodes.size();
+            nodes[node].children.push_back({ c, next });
+            nodes.push_back(Node{});
+        }
+        node = next;
+    }
+    nodes[node].counts[kind]++;
+    nodes[node].symbol = symbol;
+}
+
+// nodes are kept around after their last symbol is removed, they're likely to be reused while typing
+void SymbolTrie::Remove(const std::string& name, SymbolKind kind) {
+    int node{ 0 };
+    for (char c : name) {
+        node = Child(node, c);
+        if (node == -1) {
+            return;
+        }
+    }
+    if (nodes[node].counts[kind] > 0) {
+        nodes[node].counts[kind]--;
+    }
+}
+
+size_t SymbolTrie::Match(std::string_view str, size_t index, SymbolMatch (&longest)[SymbolKindCount]) const {
+    for (SymbolMatch& match : longest) {
+        match = SymbolMatch{ 0, -1 };
+    }
+    int node{ 0 };
+    for (size_t i{ index }; i < str.size(); i++) {
+        node = Child(node, str[i]);
+        if (node == -1) {
+            return i + 1;
+        }
+        for (int kind{ 0 }; kind < SymbolKindCount; kind++) {
+            if (nodes[node].counts[kind] > 0) {
+                longest[kind] = SymbolMatch{ i - index + 1, nodes[node].symbol };
+            }
+        }
+    }
+    return str.size() + 1;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+
+enum SymbolKind {
+    SKOperator,
+    SKOperand,
+    SKVariable,
+    SKUserFunction,
+    SymbolKindCount
+};
+
+struct SymbolMatch {
+    size_t length; // 0 if nothing of this kind matched
+    int symbol; // the matched name's id in the SymbolTable
+};
+
+// prefix tree over every identifier the tokenizer can recognize. Symbols are reference counted per kind,
+// so the same name can be inserted more than once (like a function argument shadowing a variable)
+class SymbolTrie {
+private:
+    struct Node {
+        std::vector<std::pair<char, int>> children;
+        int counts[SymbolKindCount];
+        int symbol;
+    };
+
+    std::vector<Node> nodes{ Node{} };
+
+    int Child(int node, char c) const;
+
+public:
+    void Insert(const std::string& name, SymbolKind kind, int symbol);
+    void Remove(const std::string& name, SymbolKind kind);
+    // fills longest with the longest symbol of each kind that str has at index. Returns one past the last character it
+    // had to look at, running into the end of str counts as looking one past it
+    size_t Match(std::string_view str, size_t index, SymbolMatch (&longest)[SymbolKindCount]) const;
+};
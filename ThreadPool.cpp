@@ -0,0 +1,104 @@
+#include "ThreadPool.h"
+
+// which pool and queue the current thread works for, so tasks submitted from a worker stay local
+static thread_local ThreadPool* currentPool = nullptr;
+static thread_local size_t currentQueue = 0;
+
+ThreadPool::ThreadPool(size_t threadCount) {
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+    for (size_t i{ 0 }; i < threadCount; i++) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i{ 0 }; i < threadCount; i++) {
+        threads.emplace_back(&ThreadPool::Run, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+size_t ThreadPool::Size() {
+    return threads.size();
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+    size_t index;
+    if (currentPool == this) {
+        index = currentQueue;
+    } else {
+        std::lock_guard<std::mutex> lock(mutex);
+        index = nextQueue++ % queues.size();
+    }
+    // counted before it's visible, so a worker can't finish it before pending includes it
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued++;
+        pending++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+bool ThreadPool::Pop(size_t index, std::function<void()>& task) {
+    for (size_t i{ 0 }; i < queues.size(); i++) {
+        Queue& queue = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        std::lock_guard<std::mutex> counts(mutex);
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::Run(size_t index) {
+    currentPool = this;
+    currentQueue = index;
+    while (true) {
+        std::function<void()> task;
+        if (Pop(index, task)) {
+            task();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0) {
+                idle.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return pending == 0; });
+}
+
+bool ThreadPool::IsWorker() {
+    return currentPool == this;
+}
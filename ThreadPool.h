@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+// fixed set of workers, each with its own task deque. Workers run their own tasks newest first
+// and steal the oldest tasks from each other when they run out
+class ThreadPool {
+private:
+    struct Queue {
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    size_t queued{ 0 }; // tasks sitting in a deque
+    size_t pending{ 0 }; // tasks submitted but not finished
+    bool stopping{ false };
+    size_t nextQueue{ 0 };
+
+    bool Pop(size_t index, std::function<void()>& task);
+    void Run(size_t index);
+
+public:
+    explicit ThreadPool(size_t threadCount = std::thread::hardware_concurrency());
+    ~ThreadPool();
+    size_t Size();
+    // safe to call from inside a task, which is how work spreads out
+    void Submit(std::function<void()> task);
+    // blocks until every submitted task, including the ones they submitted, has finished
+    void Wait();
+    // whether the calling thread is one of the workers. A task that blocks on tasks of its own can end up holding
+    // the only worker that could run them
+    bool IsWorker();
+};